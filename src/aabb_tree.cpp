@@ -0,0 +1,198 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "aabb_tree.h"
+
+namespace broadphase
+{
+    int aabb_tree::allocate_node()
+    {
+        if(free_list < 0)
+        {
+            nodes.push_back({});
+            free_list = static_cast<int>(nodes.size()-1);
+            nodes[free_list].parent = -1;
+        }
+        const int n = free_list;
+        free_list = nodes[n].parent;
+        nodes[n] = {{}, -1, {-1,-1}, 0};
+        return n;
+    }
+
+    void aabb_tree::free_node(int n)
+    {
+        nodes[n].parent = free_list;
+        nodes[n].height = -1;
+        free_list = n;
+    }
+
+    void aabb_tree::insert_leaf(int leaf)
+    {
+        if(root < 0)
+        {
+            root = leaf;
+            nodes[root].parent = -1;
+            return;
+        }
+
+        // Descend the tree to find the sibling which minimizes the total perimeter of the tree
+        const aabb box = nodes[leaf].box;
+        int index = root;
+        while(!nodes[index].is_leaf())
+        {
+            const node & n = nodes[index];
+            const float area = perimeter(n.box), combined_area = perimeter(combine(n.box, box));
+            const float cost = 2*combined_area;                     // Cost of creating a new parent for this node and the new leaf
+            const float inheritance_cost = 2*(combined_area - area); // Minimum cost of pushing the leaf further down the tree
+
+            float child_cost[2];
+            for(int i=0; i<2; ++i)
+            {
+                const node & c = nodes[n.child[i]];
+                const float new_area = perimeter(combine(box, c.box));
+                child_cost[i] = inheritance_cost + (c.is_leaf() ? new_area : new_area - perimeter(c.box));
+            }
+            if(cost < child_cost[0] && cost < child_cost[1]) break;
+            index = n.child[child_cost[0] < child_cost[1] ? 0 : 1];
+        }
+
+        // Create a new parent for the sibling and the new leaf
+        const int sibling = index, old_parent = nodes[sibling].parent, new_parent = allocate_node();
+        nodes[new_parent] = {combine(box, nodes[sibling].box), old_parent, {sibling, leaf}, nodes[sibling].height + 1};
+        nodes[sibling].parent = new_parent;
+        nodes[leaf].parent = new_parent;
+        if(old_parent < 0) root = new_parent;
+        else nodes[old_parent].child[nodes[old_parent].child[0] == sibling ? 0 : 1] = new_parent;
+
+        // Walk back up the tree, fixing heights and bounds
+        for(index = new_parent; index >= 0; index = nodes[index].parent)
+        {
+            index = balance(index);
+            node & n = nodes[index];
+            n.height = 1 + std::max(nodes[n.child[0]].height, nodes[n.child[1]].height);
+            n.box = combine(nodes[n.child[0]].box, nodes[n.child[1]].box);
+        }
+    }
+
+    void aabb_tree::remove_leaf(int leaf)
+    {
+        if(leaf == root)
+        {
+            root = -1;
+            return;
+        }
+
+        // Replace the leaf's parent with the leaf's sibling
+        const int parent = nodes[leaf].parent, grand_parent = nodes[parent].parent;
+        const int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+        nodes[sibling].parent = grand_parent;
+        free_node(parent);
+        if(grand_parent < 0)
+        {
+            root = sibling;
+            return;
+        }
+        nodes[grand_parent].child[nodes[grand_parent].child[0] == parent ? 0 : 1] = sibling;
+
+        // Walk back up the tree, fixing heights and bounds
+        for(int index = grand_parent; index >= 0; index = nodes[index].parent)
+        {
+            index = balance(index);
+            node & n = nodes[index];
+            n.height = 1 + std::max(nodes[n.child[0]].height, nodes[n.child[1]].height);
+            n.box = combine(nodes[n.child[0]].box, nodes[n.child[1]].box);
+        }
+    }
+
+    // If the subtree rooted at a is imbalanced, promote the root of its taller child, and return the new root of the subtree
+    int aabb_tree::balance(int a)
+    {
+        if(nodes[a].is_leaf() || nodes[a].height < 2) return a;
+        const int b = nodes[a].child[0], c = nodes[a].child[1];
+        const int h = nodes[c].height - nodes[b].height;
+        if(h >= -1 && h <= 1) return a;
+
+        // Rotate the taller child (f) up, and move its shorter grandchild down to replace it beneath a
+        const int f = h > 0 ? c : b, e = h > 0 ? b : c;
+        const int g = nodes[f].child[0], k = nodes[f].child[1];
+        const int taller = nodes[g].height > nodes[k].height ? g : k, shorter = taller == g ? k : g;
+
+        nodes[f].child[0] = a;
+        nodes[f].child[1] = taller;
+        nodes[f].parent = nodes[a].parent;
+        nodes[a].parent = f;
+        if(nodes[f].parent < 0) root = f;
+        else nodes[nodes[f].parent].child[nodes[nodes[f].parent].child[0] == a ? 0 : 1] = f;
+
+        nodes[a].child[0] = e;
+        nodes[a].child[1] = shorter;
+        nodes[shorter].parent = a;
+        nodes[a].box = combine(nodes[e].box, nodes[shorter].box);
+        nodes[a].height = 1 + std::max(nodes[e].height, nodes[shorter].height);
+        nodes[f].box = combine(nodes[a].box, nodes[taller].box);
+        nodes[f].height = 1 + std::max(nodes[a].height, nodes[taller].height);
+        return f;
+    }
+
+    int aabb_tree::create_proxy(const aabb & box)
+    {
+        const int proxy = allocate_node();
+        if(boxes.size() < nodes.size()) boxes.resize(nodes.size());
+        boxes[proxy] = box;
+        nodes[proxy].box = expand(box, margin);
+        insert_leaf(proxy);
+        ++proxy_count;
+        return proxy;
+    }
+
+    void aabb_tree::destroy_proxy(int proxy)
+    {
+        remove_leaf(proxy);
+        free_node(proxy);
+        --proxy_count;
+    }
+
+    bool aabb_tree::move_proxy(int proxy, const aabb & box)
+    {
+        boxes[proxy] = box;
+        if(contains(nodes[proxy].box, box)) return false;
+        remove_leaf(proxy);
+        nodes[proxy].box = expand(box, margin);
+        insert_leaf(proxy);
+        return true;
+    }
+
+    void aabb_tree::find_pairs(std::vector<pair> & pairs)
+    {
+        // Descend the tree against itself, visiting each pair of overlapping subtrees once. This touches far fewer nodes, with much better 
+        // locality, than querying the tree separately for each leaf. A pair (a,a) denotes finding all pairs within the subtree at a.
+        pairs.clear();
+        stack.clear();
+        if(root >= 0) stack.push_back({root, root});
+        while(!stack.empty())
+        {
+            const auto [a, b] = stack.back();
+            stack.pop_back();
+            const node & na = nodes[a], & nb = nodes[b];
+            if(a == b)
+            {
+                if(na.is_leaf()) continue;
+                stack.push_back({na.child[0], na.child[0]});
+                stack.push_back({na.child[1], na.child[1]});
+                stack.push_back({na.child[0], na.child[1]});
+            }
+            else if(!overlaps(na.box, nb.box)) continue;
+            else if(na.is_leaf() && nb.is_leaf()) { if(overlaps(boxes[a], boxes[b])) pairs.push_back({std::min(a, b), std::max(a, b)}); }
+            else if(nb.is_leaf() || (!na.is_leaf() && perimeter(na.box) >= perimeter(nb.box)))
+            {
+                stack.push_back({na.child[0], b});
+                stack.push_back({na.child[1], b});
+            }
+            else
+            {
+                stack.push_back({a, nb.child[0]});
+                stack.push_back({a, nb.child[1]});
+            }
+        }
+        stats = {proxy_count, pairs.size(), proxy_count ? proxy_count*(proxy_count-1)/2 : 0};
+    }
+}
@@ -0,0 +1,93 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include "broadphase.h"
+
+namespace broadphase
+{
+    // Dynamic bounding volume hierarchy. Each proxy is stored as a leaf with a "fat" AABB, enlarged by a margin, so that bodies
+    // which move less than the margin do not require any changes to the tree. Subtrees are kept balanced using tree rotations.
+    class aabb_tree
+    {
+        struct node 
+        { 
+            aabb box;
+            int parent;     // Also used as the next pointer when the node is in the free list
+            int child[2];   // Both -1 for leaf nodes
+            int height;     // 0 for leaf nodes, -1 for free nodes
+            bool is_leaf() const { return child[0] < 0; }
+        };
+        std::vector<node> nodes;
+        std::vector<aabb> boxes;    // Bounds given for each proxy, indexed by leaf node, which are checked once their fat AABBs overlap
+        int root = -1, free_list = -1;
+        size_t proxy_count = 0;
+        float margin;
+        std::vector<std::pair<int,int>> stack; // Scratch space for find_pairs
+        pair_stats stats {};
+
+        int allocate_node();
+        void free_node(int n);
+        void insert_leaf(int leaf);
+        void remove_leaf(int leaf);
+        int balance(int a);
+    public:
+        explicit aabb_tree(float margin = 0.1f) : margin{margin} {}
+
+        int create_proxy(const aabb & box);
+        void destroy_proxy(int proxy);
+        bool move_proxy(int proxy, const aabb & box); // Returns false if the box was still contained within the proxy's fat AABB, in which case the tree is unchanged
+        const aabb & get_bounds(int proxy) const { return boxes[proxy]; }
+        const aabb & get_fat_bounds(int proxy) const { return nodes[proxy].box; }
+        int get_height() const { return root < 0 ? 0 : nodes[root].height; }
+
+        // Replaces the contents of pairs with all pairs of proxies whose bounds overlap. The tree finds pairs whose fat AABBs overlap, 
+        // which are then checked against their actual bounds, so that the margin does not send extra pairs to the narrowphase.
+        void find_pairs(std::vector<pair> & pairs);
+        const pair_stats & get_stats() const { return stats; }
+
+        // Invokes callback(proxy) for every proxy whose fat AABB overlaps the region, stopping early if the callback returns false
+        template<class Callback> void query(const aabb & region, Callback callback) const
+        {
+            int stack[64], count = 0;
+            if(root >= 0) stack[count++] = root;
+            while(count)
+            {
+                const node & n = nodes[stack[--count]];
+                if(!overlaps(n.box, region)) continue;
+                if(n.is_leaf()) { if(!callback(static_cast<int>(&n - nodes.data()))) return; }
+                else { stack[count++] = n.child[0]; stack[count++] = n.child[1]; }
+            }
+        }
+
+        // Invokes callback(proxy, max_t) for every proxy whose fat AABB is hit by the ray origin + direction*t for t in [0, max_t], nearest 
+        // first. The callback returns the new value of max_t, allowing it to clip the ray to the nearest hit so far, which prunes every 
+        // subtree beyond it, or to stop the query by returning 0.
+        template<class Callback> void raycast(const float2 & origin, const float2 & direction, float max_t, Callback callback) const
+        {
+            boxcast({origin, origin}, direction, max_t, callback);
+        }
+
+        // As raycast, but for the box swept along direction*t, reporting every proxy whose fat AABB the swept box touches
+        template<class Callback> void boxcast(const aabb & box, const float2 & direction, float max_t, Callback callback) const
+        {
+            // Nodes are grown by the size of the box so that the sweep reduces to a ray from its minimum corner
+            const float2 inv_direction = 1.0f / direction, size = box.max - box.min;
+            const auto get_entry = [&](int n) { return find_ray_entry({nodes[n].box.min - size, nodes[n].box.max}, box.min, inv_direction, max_t); };
+            struct entry { int node; float t; } stack[64];
+            int count = 0;
+            if(root >= 0) stack[count++] = {root, get_entry(root)};
+            while(count)
+            {
+                const entry e = stack[--count];
+                if(e.t > max_t) continue; // Beyond a hit found since this node was pushed
+                const node & n = nodes[e.node];
+                if(n.is_leaf()) { max_t = callback(e.node, max_t); if(!(max_t > 0)) return; continue; }
+
+                // Push the farther child first, so that the nearer is visited first
+                entry children[2] {{n.child[0], get_entry(n.child[0])}, {n.child[1], get_entry(n.child[1])}};
+                if(children[0].t < children[1].t) std::swap(children[0], children[1]);
+                for(auto & c : children) if(c.t <= max_t) stack[count++] = c;
+            }
+        }
+    };
+}
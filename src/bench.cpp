@@ -0,0 +1,434 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <atomic>
+#include "aabb_tree.h"
+#include "spatial_hash.h"
+#include "hierarchical_grid.h"
+#include "collision.h"
+#include "shapes.h"
+#include "bounds.h"
+
+using clock_type = std::chrono::high_resolution_clock;
+template<class F> double time_seconds(F f) { const auto t0 = clock_type::now(); f(); return std::chrono::duration<double>(clock_type::now() - t0).count(); }
+
+// Track heap usage by prefixing every allocation with its size. The counters are atomic, as the spatial hash allocates on its worker threads.
+static std::atomic<size_t> live_bytes, peak_bytes;
+void * operator new(size_t size)
+{
+    auto p = static_cast<size_t *>(std::malloc(size + 16));
+    if(!p) throw std::bad_alloc();
+    *p = size;
+    const size_t live = live_bytes += size;
+    for(size_t peak = peak_bytes; peak < live && !peak_bytes.compare_exchange_weak(peak, live); ) {}
+    return reinterpret_cast<char *>(p) + 16;
+}
+void operator delete(void * p) noexcept
+{
+    if(!p) return;
+    auto q = reinterpret_cast<size_t *>(reinterpret_cast<uintptr_t>(p) - 16);
+    live_bytes -= *q;
+    std::free(q);
+}
+void operator delete(void * p, size_t) noexcept { operator delete(p); }
+
+// Tests every box against every other box using each implementation of the SIMD overlap kernel
+void bench_overlap()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> position_dist(-20, 20), size_dist(0.1f, 0.5f);
+    broadphase::bounds_array bounds;
+    bounds.resize(4096);
+    for(size_t i=0; i<bounds.size(); ++i)
+    {
+        const float2 p {position_dist(rng), position_dist(rng)};
+        bounds.set(i, {p, p + float2{size_dist(rng), size_dist(rng)}});
+    }
+
+    std::vector<int> out(bounds.size());
+    const struct { const char * name; decltype(&broadphase::detail::find_overlaps_scalar) kernel; } kernels[] {
+        {"scalar", broadphase::detail::find_overlaps_scalar},
+        {"sse2", broadphase::detail::find_overlaps_sse2},
+        {"avx2", broadphase::detail::cpu_supports_avx2() ? broadphase::detail::find_overlaps_avx2 : nullptr},
+    };
+    for(auto & k : kernels)
+    {
+        if(!k.kernel) { std::cout << k.name << ": not supported" << std::endl; continue; }
+        size_t overlaps = 0, tests = 0;
+        const double seconds = time_seconds([&]()
+        {
+            for(int iteration=0; iteration<16; ++iteration)
+            {
+                for(size_t i=0; i<bounds.size(); ++i) overlaps += k.kernel(bounds, 0, bounds.size(), bounds.get(i), out.data());
+                tests += bounds.size()*bounds.size();
+            }
+        });
+        std::cout << k.name << ": " << tests/seconds/1e6 << " million pair tests/s, " << overlaps << " overlaps" << std::endl;
+    }
+}
+
+// A scene is a set of circles and segments, where segments are circles of radius zero swept from p0 to p1
+struct scene_object { float2 p0, p1; float radius; };
+broadphase::aabb get_bounds(const scene_object & o) { return {min(o.p0, o.p1) - o.radius, max(o.p0, o.p1) + o.radius}; }
+float distance_to_segment(const float2 & p, const float2 & a, const float2 & b) 
+{ 
+    const float2 ab = b - a; 
+    const float t = dot(ab,ab) > 0 ? std::min(std::max(dot(p - a, ab) / dot(ab,ab), 0.0f), 1.0f) : 0;
+    return distance(p, a + ab*t); 
+}
+bool shapes_overlap(const scene_object & a, const scene_object & b)
+{
+    // Objects overlap if their segments are closer than the sum of their radii. Two segments which cross have a separation of zero.
+    const float2 da = a.p1 - a.p0, db = b.p1 - b.p0;
+    const float denom = cross(da, db);
+    if(denom != 0)
+    {
+        const float s = cross(b.p0 - a.p0, db) / denom, t = cross(b.p0 - a.p0, da) / denom;
+        if(s >= 0 && s <= 1 && t >= 0 && t <= 1) return true;
+    }
+    const float d = std::min(std::min(distance_to_segment(a.p0, b.p0, b.p1), distance_to_segment(a.p1, b.p0, b.p1)), 
+                             std::min(distance_to_segment(b.p0, a.p0, a.p1), distance_to_segment(b.p1, a.p0, a.p1)));
+    return d <= a.radius + b.radius;
+}
+
+std::vector<scene_object> generate_scene(const std::string & name, size_t count, std::mt19937 & rng)
+{
+    std::vector<scene_object> objects;
+    std::normal_distribution<float> granular_radius(0.14f, 0.02f);
+    auto circle = [&](const float2 & p, float r) { objects.push_back({p, p, std::max(r, 0.01f)}); };
+    auto uniform = [&](float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(rng); };
+    if(name == "uniform")
+    {
+        // Granular bodies covering roughly a third of the area
+        const float side = std::sqrt(count * 3.14159f * 0.14f * 0.14f / 0.3f);
+        for(size_t i=0; i<count; ++i) circle({uniform(0, side), uniform(0, side)}, granular_radius(rng));
+    }
+    else if(name == "pile")
+    {
+        // Granular bodies heaped in a wide, shallow box with nearly full coverage, so most bodies touch several neighbors
+        const float width = std::sqrt(count * 3.14159f * 0.14f * 0.14f / 0.9f * 4), height = width / 4;
+        for(size_t i=0; i<count; ++i) circle({uniform(0, width), uniform(0, height)}, granular_radius(rng));
+    }
+    else if(name == "islands")
+    {
+        // Dense clusters of a hundred bodies each, scattered sparsely
+        const float side = std::sqrt(count * 3.14159f * 0.14f * 0.14f / 0.02f);
+        std::normal_distribution<float> spread(0, 1.0f);
+        float2 center;
+        for(size_t i=0; i<count; ++i) 
+        {
+            if(i % 100 == 0) center = {uniform(0, side), uniform(0, side)};
+            circle(center + float2{spread(rng), spread(rng)}, granular_radius(rng));
+        }
+    }
+    else if(name == "segments")
+    {
+        // Long thin segments of lengths between 1 and 10, in random directions
+        const float side = std::sqrt(static_cast<float>(count)) * 4;
+        for(size_t i=0; i<count; ++i)
+        {
+            const float2 p {uniform(0, side), uniform(0, side)};
+            const float angle = uniform(0, 6.28318531f), length = uniform(1, 10);
+            objects.push_back({p, p + float2{std::cos(angle), std::sin(angle)}*length, 0});
+        }
+    }
+    else if(name == "mixed")
+    {
+        // Mostly tiny debris, with some medium bodies and a few very large ones
+        const float side = std::sqrt(static_cast<float>(count)) * 0.5f;
+        for(size_t i=0; i<count; ++i)
+        {
+            const float r = i % 100 == 0 ? uniform(2, 10) : i % 10 == 0 ? uniform(0.2f, 0.4f) : uniform(0.01f, 0.04f);
+            circle({uniform(0, side), uniform(0, side)}, r);
+        }
+    }
+    return objects;
+}
+
+// The all-pairs loop formerly used by main.cpp, wrapped in the broadphase interface
+class all_pairs
+{
+    std::vector<broadphase::aabb> boxes;
+    broadphase::pair_stats stats {};
+public:
+    int create_proxy(const broadphase::aabb & box) { boxes.push_back(box); return static_cast<int>(boxes.size()-1); }
+    void move_proxy(int proxy, const broadphase::aabb & box) { boxes[proxy] = box; }
+    void find_pairs(std::vector<broadphase::pair> & pairs)
+    {
+        pairs.clear();
+        for(int i=0, n=static_cast<int>(boxes.size()); i<n; ++i) for(int j=i+1; j<n; ++j) if(overlaps(boxes[i], boxes[j])) pairs.push_back({i,j});
+        stats = {boxes.size(), pairs.size(), boxes.size()*(boxes.size()-1)/2};
+    }
+    const broadphase::pair_stats & get_stats() const { return stats; }
+};
+
+// Creates proxies for every object, then runs several frames of small coherent motion, timing proxy updates and pair queries separately
+template<class Broadphase> void bench_broadphase(const char * strategy, const std::string & scene, std::vector<scene_object> objects, bool & first)
+{
+    std::mt19937 rng;
+    std::normal_distribution<float> jitter(0, 0.01f);
+    std::vector<broadphase::pair> pairs;
+    std::vector<int> proxies(objects.size());
+    double build_time = 0, update_time = 0, query_time = 0;
+    size_t false_positives = 0;
+    const int frames = 3;
+
+    const size_t baseline_bytes = live_bytes;
+    peak_bytes = live_bytes.load();
+    {
+        Broadphase bp;
+        build_time = time_seconds([&]() { for(size_t i=0; i<objects.size(); ++i) proxies[i] = bp.create_proxy(get_bounds(objects[i])); });
+        for(int frame=0; frame<frames; ++frame)
+        {
+            for(auto & o : objects)
+            {
+                const float2 offset {jitter(rng), jitter(rng)};
+                o.p0 += offset;
+                o.p1 += offset;
+            }
+            update_time += time_seconds([&]() { for(size_t i=0; i<objects.size(); ++i) bp.move_proxy(proxies[i], get_bounds(objects[i])); });
+            query_time += time_seconds([&]() { bp.find_pairs(pairs); });
+        }
+
+        // Proxy IDs need not be object indices, as tree proxies are node indices, so map pairs back to objects through the proxies
+        std::vector<int> objects_by_proxy(*std::max_element(proxies.begin(), proxies.end()) + 1);
+        for(size_t i=0; i<objects.size(); ++i) objects_by_proxy[proxies[i]] = static_cast<int>(i);
+        for(auto & p : pairs) if(!shapes_overlap(objects[objects_by_proxy[p.a]], objects[objects_by_proxy[p.b]])) ++false_positives;
+    }
+
+    std::cout << (first ? "" : ",\n") << "  {\"scene\": \"" << scene << "\", \"count\": " << objects.size() << ", \"strategy\": \"" << strategy << "\", "
+        << "\"pairs\": " << pairs.size() << ", \"false_positive_rate\": " << (pairs.empty() ? 0.0 : (double)false_positives/pairs.size()) << ", "
+        << "\"build_ms\": " << build_time*1000 << ", \"update_ms\": " << update_time*1000/frames << ", \"query_ms\": " << query_time*1000/frames << ", "
+        << "\"memory_bytes\": " << peak_bytes - baseline_bytes << "}";
+    first = false;
+}
+
+// Times pair generation for every broadphase strategy over a range of scene types and sizes, writing results as a JSON array
+void bench_broadphases(size_t max_count)
+{
+    bool first = true;
+    std::cout << "[\n";
+    for(const char * scene : {"uniform", "pile", "islands", "segments", "mixed"})
+    {
+        for(size_t count : {1000, 10000, 50000, 200000})
+        {
+            if(count > max_count) continue;
+            std::mt19937 rng;
+            const auto objects = generate_scene(scene, count, rng);
+            if(count <= 10000) bench_broadphase<all_pairs>("all_pairs", scene, objects, first); // Quadratic, and far too slow for larger scenes
+            bench_broadphase<broadphase::sweep_and_prune>("sweep_and_prune", scene, objects, first);
+            bench_broadphase<broadphase::aabb_tree>("aabb_tree", scene, objects, first);
+            bench_broadphase<broadphase::spatial_hash>("spatial_hash", scene, objects, first);
+            bench_broadphase<broadphase::hierarchical_grid>("hierarchical_grid", scene, objects, first);
+        }
+    }
+    std::cout << "\n]" << std::endl;
+}
+
+// Times the scalar and batched GJK and EPA entry points on random overlapping pairs of one shape type pair
+template<class BatchA> void bench_gjk(const char * name, const BatchA & a, const collision::polygon_batch & b, const std::vector<float2> & points_a, const std::vector<float2> & points_b)
+{
+    const size_t count = b.size();
+    const int na = static_cast<int>(points_a.size()/count), nb = b.vertex_count;
+    auto polygon_support = [](const float2 * points, int n, const float2 & d)
+    {
+        int best = 0;
+        for(int j=1; j<n; ++j) if(dot(points[j], d) > dot(points[best], d)) best = j;
+        return points[best];
+    };
+    auto support_a = [&](size_t i)
+    {
+        return [&, i](const float2 & d) { return na ? polygon_support(&points_a[i*na], na, d) : a.support(i, d); };
+    };
+    auto support_b = [&](size_t i) { return [&, i](const float2 & d) { return polygon_support(&points_b[i*nb], nb, d); }; };
+
+    std::unique_ptr<bool[]> hits(new bool[count]);
+    std::vector<std::optional<collision::penetration>> pens(count);
+    size_t scalar_hits = 0, batched_hits = 0;
+    const double scalar_check = time_seconds([&]() { for(size_t i=0; i<count; ++i) scalar_hits += collision::check_intersection(support_a(i), support_b(i), {1,0}); });
+    const double batched_check = time_seconds([&]() { collision::check_intersections(a, b, hits.get()); });
+    const double scalar_find = time_seconds([&]() { for(size_t i=0; i<count; ++i) pens[i] = collision::find_intersection(support_a(i), support_b(i), {1,0}); });
+    const double batched_find = time_seconds([&]() { collision::find_intersections(a, b, pens.data()); });
+    for(size_t i=0; i<count; ++i) batched_hits += hits[i];
+    std::cout << name << ": " << count/scalar_check/1e6 << " / " << count/batched_check/1e6 << " million boolean tests/s (scalar / batched), " 
+        << count/scalar_find/1e6 << " / " << count/batched_find/1e6 << " million penetration queries/s, " << batched_hits << " hits" 
+        << (scalar_hits == batched_hits ? "" : " MISMATCH") << std::endl;
+}
+
+void bench_gjks()
+{
+    const size_t count = 1 << 18;
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> position_dist(-1, 1), angle_dist(-3.14159265f, 3.14159265f), radius_dist(0.5f, 1.0f);
+    auto make_polygon = [&](int n, std::vector<float2> & points, collision::polygon_batch & batch)
+    {
+        const float2 center {position_dist(rng), position_dist(rng)};
+        const float angle = angle_dist(rng), radius = radius_dist(rng);
+        for(int j=0; j<n; ++j) points.push_back(center + rot(angle + j*6.28318531f/n, float2{radius, 0}));
+        batch.push_back(&points[points.size()-n]);
+    };
+
+    for(int n : {4, 6})
+    {
+        collision::polygon_batch a(n), b(n);
+        std::vector<float2> points_a, points_b;
+        for(size_t i=0; i<count; ++i)
+        {
+            make_polygon(n, points_a, a);
+            make_polygon(n, points_b, b);
+        }
+        bench_gjk(n == 4 ? "box-box" : "hexagon-hexagon", a, b, points_a, points_b);
+    }
+
+    collision::circle_batch a;
+    collision::polygon_batch b(6);
+    std::vector<float2> points_b;
+    for(size_t i=0; i<count; ++i)
+    {
+        a.push_back({position_dist(rng), position_dist(rng)}, radius_dist(rng));
+        make_polygon(6, points_b, b);
+    }
+    bench_gjk("circle-hexagon", a, b, {}, points_b);
+}
+
+// Compares the GJK+EPA and MPR engines on the same pairs, for speed and for agreement on penetration depth and normal
+template<class SupportA, class SupportB> void bench_engines(const std::string & name, size_t count, SupportA support_a, SupportB support_b)
+{
+    std::vector<std::optional<collision::penetration>> gjk(count), mpr(count);
+    const double gjk_time = time_seconds([&]() { for(size_t i=0; i<count; ++i) gjk[i] = collision::find_intersection<collision::gjk_epa>(support_a(i), support_b(i), {1,0}); });
+    const double mpr_time = time_seconds([&]() { for(size_t i=0; i<count; ++i) mpr[i] = collision::find_intersection<collision::mpr>(support_a(i), support_b(i), {1,0}); });
+    size_t hits = 0, mismatches = 0;
+    double depth_error = 0, angle_error = 0, max_angle_error = 0;
+    for(size_t i=0; i<count; ++i)
+    {
+        if(gjk[i].has_value() != mpr[i].has_value()) ++mismatches;
+        if(!gjk[i] || !mpr[i]) continue;
+        const double angle = std::acos(std::min(std::max(dot(gjk[i]->n, mpr[i]->n), -1.0f), 1.0f)) * 57.2957795;
+        depth_error += mpr[i]->d - gjk[i]->d;
+        angle_error += angle;
+        max_angle_error = std::max(max_angle_error, angle);
+        ++hits;
+    }
+    std::cout << name << ": " << count/gjk_time/1e6 << " / " << count/mpr_time/1e6 << " million penetration queries/s (GJK+EPA / MPR), " << hits << " hits, " 
+        << mismatches << " mismatches, MPR depth exceeds EPA by " << (hits ? depth_error/hits : 0) << " and normals differ by " << (hits ? angle_error/hits : 0) 
+        << " degrees on average (" << max_angle_error << " max)" << std::endl;
+}
+
+void bench_engines()
+{
+    const size_t count = 1 << 16;
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> position_dist(-1, 1), angle_dist(-3.14159265f, 3.14159265f), radius_dist(0.5f, 1.0f), gap_dist(0.9f, 1.0f);
+    const struct { int sides_a, sides_b; const char * name; } pairs[] {{4, 4, "box-box"}, {6, 6, "hexagon-hexagon"}, {0, 6, "circle-hexagon"}, {0, 4, "circle-box"}}; // Zero sides for circles
+    for(bool shallow : {false, true})
+    {
+        for(auto & pair : pairs)
+        {
+            // Shallow pairs are placed with their bounding circles just overlapping, otherwise anywhere in the unit square
+            std::vector<float2> centers_a, centers_b, points_a, points_b;
+            std::vector<float> radii_a, radii_b;
+            for(size_t i=0; i<count; ++i)
+            {
+                const float ra = radius_dist(rng), rb = radius_dist(rng);
+                const float2 ca {position_dist(rng), position_dist(rng)};
+                const float2 cb = shallow ? ca + rot(angle_dist(rng), float2{(ra+rb)*gap_dist(rng), 0}) : float2{position_dist(rng), position_dist(rng)};
+                const float angle_a = angle_dist(rng), angle_b = angle_dist(rng);
+                for(int j=0; j<pair.sides_a; ++j) points_a.push_back(ca + rot(angle_a + j*6.28318531f/pair.sides_a, float2{ra, 0}));
+                for(int j=0; j<pair.sides_b; ++j) points_b.push_back(cb + rot(angle_b + j*6.28318531f/pair.sides_b, float2{rb, 0}));
+                centers_a.push_back(ca); centers_b.push_back(cb);
+                radii_a.push_back(ra); radii_b.push_back(rb);
+            }
+            auto get_support = [](const std::vector<float2> & centers, const std::vector<float> & radii, const std::vector<float2> & points, int sides)
+            {
+                return [&, sides](size_t i) 
+                { 
+                    return [&, sides, i](const float2 & d) 
+                    { 
+                        if(!sides) return centers[i] + normalize(d) * radii[i];
+                        const float2 * p = &points[i*sides];
+                        int best = 0;
+                        for(int j=1; j<sides; ++j) if(dot(p[j], d) > dot(p[best], d)) best = j;
+                        return p[best];
+                    }; 
+                };
+            };
+            bench_engines(std::string(pair.name) + (shallow ? " (shallow)" : ""), count, get_support(centers_a, radii_a, points_a, pair.sides_a), get_support(centers_b, radii_b, points_b, pair.sides_b));
+        }
+    }
+}
+
+// Collides bodies resting on long generated terrain with each representation of it. Discrete segments are scanned linearly, as the world
+// segments once were, chains bisect their runs of edges monotone in x, and heightfields find the edges beneath each body from their 
+// spacing. Bytes per sample count all the storage each representation queries, including the runs of the chain and the BVH over them.
+void bench_terrain(int sample_count)
+{
+    const size_t body_count = 1 << 14, scanned_count = 1 << 8;
+    size_t bytes = live_bytes;
+    const auto field = generate_terrain(1, {0,0}, sample_count, 0.05f, 4.0f, 512);
+    const size_t field_bytes = live_bytes - bytes;
+    bytes = live_bytes;
+    const auto quantized = quantize(field);
+    const size_t quantized_bytes = live_bytes - bytes;
+    std::vector<float2> points;
+    for(int i=0; i<sample_count; ++i) points.push_back(field.get_vertex(i));
+    bytes = live_bytes;
+    const chain terrain {points, false};
+    const size_t chain_bytes = live_bytes - bytes;
+    bytes = live_bytes;
+    std::vector<segment> segments;
+    segments.reserve(field.get_edge_count());
+    for(int i=0; i<field.get_edge_count(); ++i) segments.push_back(field.get_edge(i));
+    const size_t segment_bytes = live_bytes - bytes;
+
+    // Bodies are about four samples wide, placed within a few centimeters of the surface
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> x_dist(0, (sample_count-1)*field.spacing), gap_dist(-0.02f, 0.05f), angle_dist(-3.14159265f, 3.14159265f);
+    std::vector<shape> bodies;
+    for(size_t i=0; i<body_count; ++i)
+    {
+        const float x = x_dist(rng), y = field.get_vertex(static_cast<int>(x / field.spacing)).y + 0.1f + gap_dist(rng);
+        if(i % 2) bodies.push_back(circle{{x, y}, 0.1f});
+        else bodies.push_back(posed_box{{0.1f, 0.1f}, {x, y}, rot(angle_dist(rng), float2{1,0})});
+    }
+
+    std::vector<child_manifold> manifolds;
+    const auto run = [&](const char * name, size_t count, size_t storage, auto find)
+    {
+        manifolds.clear();
+        const double t = time_seconds([&]() { for(size_t i=0; i<count; ++i) find(bodies[i]); });
+        std::cout << name << ": " << t/count*1e9 << " ns per body, " << manifolds.size() << " manifolds for " << count << " bodies, " 
+            << static_cast<double>(storage)/sample_count << " bytes per sample" << std::endl;
+    };
+    std::cout << "terrain of " << sample_count << " samples" << std::endl;
+    run("segments", scanned_count, segment_bytes, [&](const shape & body)
+    {
+        const auto bounds = std::visit([](const auto & s) { return broadphase::expand(broadphase::compute_bounds(s), 0.05f); }, body);
+        for(auto & seg : segments)
+        {
+            if(!overlaps(broadphase::compute_bounds(seg), bounds)) continue;
+            collision::gjk_cache cache;
+            const auto m = find_manifold(body, seg, cache, 0.05f);
+            if(m.count) manifolds.push_back({-1, -1, m, cache.used_epa});
+        }
+    });
+    run("chain", body_count, chain_bytes, [&](const shape & body) { find_chain_manifolds(body, terrain, 0.05f, manifolds); });
+    run("heightfield", body_count, field_bytes, [&](const shape & body) { find_heightfield_manifolds(body, field, 0.05f, manifolds); });
+    run("quantized heightfield", body_count, quantized_bytes, [&](const shape & body) { find_heightfield_manifolds(body, quantized, 0.05f, manifolds); });
+}
+
+int main(int argc, char * argv[])
+{
+    const std::string suite = argc > 1 ? argv[1] : "all";
+    if(suite == "overlap" || suite == "all") bench_overlap();
+    if(suite == "broadphase" || suite == "all") bench_broadphases(argc > 2 ? std::stoul(argv[2]) : 200000);
+    if(suite == "gjk" || suite == "all") bench_gjks();
+    if(suite == "mpr" || suite == "all") bench_engines();
+    if(suite == "terrain" || suite == "all") bench_terrain(argc > 2 ? std::stoi(argv[2]) : 1 << 16);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "bounds.h"
+#include <cmath>
+#ifdef BROADPHASE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace broadphase
+{
+    void obb_array::push_back(const float2 & center, float cos_angle, float sin_angle, const float2 & half_extent)
+    {
+        center_x.push_back(center.x);
+        center_y.push_back(center.y);
+        cos.push_back(cos_angle);
+        sin.push_back(sin_angle);
+        half_x.push_back(half_extent.x);
+        half_y.push_back(half_extent.y);
+    }
+
+    void compute_bounds(const obb_array & boxes, bounds_array & bounds)
+    {
+        const size_t n = boxes.size();
+        bounds.resize(n);
+        size_t i = 0;
+#ifdef BROADPHASE_SSE2
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        for(; i+4 <= n; i += 4)
+        {
+            const __m128 c = _mm_and_ps(_mm_loadu_ps(&boxes.cos[i]), abs_mask), s = _mm_and_ps(_mm_loadu_ps(&boxes.sin[i]), abs_mask);
+            const __m128 hx = _mm_loadu_ps(&boxes.half_x[i]), hy = _mm_loadu_ps(&boxes.half_y[i]);
+            const __m128 ex = _mm_add_ps(_mm_mul_ps(c, hx), _mm_mul_ps(s, hy)), ey = _mm_add_ps(_mm_mul_ps(s, hx), _mm_mul_ps(c, hy));
+            const __m128 x = _mm_loadu_ps(&boxes.center_x[i]), y = _mm_loadu_ps(&boxes.center_y[i]);
+            _mm_storeu_ps(&bounds.min_x[i], _mm_sub_ps(x, ex));
+            _mm_storeu_ps(&bounds.min_y[i], _mm_sub_ps(y, ey));
+            _mm_storeu_ps(&bounds.max_x[i], _mm_add_ps(x, ex));
+            _mm_storeu_ps(&bounds.max_y[i], _mm_add_ps(y, ey));
+        }
+#endif
+        for(; i<n; ++i)
+        {
+            const float c = std::abs(boxes.cos[i]), s = std::abs(boxes.sin[i]);
+            const float ex = c*boxes.half_x[i] + s*boxes.half_y[i], ey = s*boxes.half_x[i] + c*boxes.half_y[i];
+            bounds.min_x[i] = boxes.center_x[i] - ex;
+            bounds.min_y[i] = boxes.center_y[i] - ey;
+            bounds.max_x[i] = boxes.center_x[i] + ex;
+            bounds.max_y[i] = boxes.center_y[i] + ey;
+        }
+    }
+}
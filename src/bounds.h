@@ -0,0 +1,25 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include "broadphase.h"
+
+namespace broadphase
+{
+    // Returns the tightest AABB of any shape with a support function, found by querying the support in each axis direction
+    template<class Shape> aabb compute_bounds(const Shape & s) { return {{support(s, {-1,0}).x, support(s, {0,-1}).y}, {support(s, {1,0}).x, support(s, {0,1}).y}}; }
+
+    // Oriented boxes for a set of bodies, stored as a structure of arrays. Circles are boxes with half extents equal to their radius and 
+    // no rotation, and any other shape may be described by its AABB from compute_bounds.
+    struct obb_array
+    {
+        std::vector<float> center_x, center_y, cos, sin, half_x, half_y;
+
+        size_t size() const { return center_x.size(); }
+        void clear() { center_x.clear(); center_y.clear(); cos.clear(); sin.clear(); half_x.clear(); half_y.clear(); }
+        void push_back(const float2 & center, float cos_angle, float sin_angle, const float2 & half_extent);
+        void push_back(const aabb & box) { push_back((box.min + box.max)*0.5f, 1, 0, (box.max - box.min)*0.5f); }
+    };
+
+    // Computes the AABB of every oriented box, using SSE2 where available
+    void compute_bounds(const obb_array & boxes, bounds_array & bounds);
+}
@@ -0,0 +1,156 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "broadphase.h"
+#include <algorithm>
+#ifdef BROADPHASE_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace broadphase::detail
+{
+    bool cpu_supports_avx2()
+    {
+#if !defined(BROADPHASE_SSE2)
+        return false;
+#elif defined(_MSC_VER)
+        // Check that the CPU supports AVX2 and that the OS saves YMM registers on context switches
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7) return false;
+        __cpuid(info, 1);
+        if(!(info[2] & (1<<27)) || (_xgetbv(0) & 6) != 6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1<<5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    size_t find_overlaps_scalar(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out)
+    {
+        size_t count = 0;
+        for(size_t i=begin; i<end; ++i)
+        {
+            out[count] = static_cast<int>(i);
+            count += box.min.x <= bounds.max_x[i] && bounds.min_x[i] <= box.max.x && box.min.y <= bounds.max_y[i] && bounds.min_y[i] <= box.max.y;
+        }
+        return count;
+    }
+
+#ifdef BROADPHASE_SSE2
+    // Each lane's index is written unconditionally, and the output position only advances if the lane passed the test
+    static void compact(int mask, int lanes, int first, int * out, size_t & count)
+    {
+        for(int lane=0; lane<lanes; ++lane)
+        {
+            out[count] = first + lane;
+            count += (mask >> lane) & 1;
+        }
+    }
+
+    size_t find_overlaps_sse2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out)
+    {
+        const __m128 min_x = _mm_set1_ps(box.min.x), min_y = _mm_set1_ps(box.min.y), max_x = _mm_set1_ps(box.max.x), max_y = _mm_set1_ps(box.max.y);
+        size_t i = begin, count = 0;
+        for(; i+4 <= end; i += 4)
+        {
+            const __m128 x = _mm_and_ps(_mm_cmple_ps(min_x, _mm_loadu_ps(&bounds.max_x[i])), _mm_cmple_ps(_mm_loadu_ps(&bounds.min_x[i]), max_x));
+            const __m128 y = _mm_and_ps(_mm_cmple_ps(min_y, _mm_loadu_ps(&bounds.max_y[i])), _mm_cmple_ps(_mm_loadu_ps(&bounds.min_y[i]), max_y));
+            compact(_mm_movemask_ps(_mm_and_ps(x, y)), 4, static_cast<int>(i), out, count);
+        }
+        return count + find_overlaps_scalar(bounds, i, end, box, out + count);
+    }
+
+    TARGET_AVX2 size_t find_overlaps_avx2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out)
+    {
+        const __m256 min_x = _mm256_set1_ps(box.min.x), min_y = _mm256_set1_ps(box.min.y), max_x = _mm256_set1_ps(box.max.x), max_y = _mm256_set1_ps(box.max.y);
+        size_t i = begin, count = 0;
+        for(; i+8 <= end; i += 8)
+        {
+            const __m256 x = _mm256_and_ps(_mm256_cmp_ps(min_x, _mm256_loadu_ps(&bounds.max_x[i]), _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(&bounds.min_x[i]), max_x, _CMP_LE_OQ));
+            const __m256 y = _mm256_and_ps(_mm256_cmp_ps(min_y, _mm256_loadu_ps(&bounds.max_y[i]), _CMP_LE_OQ), _mm256_cmp_ps(_mm256_loadu_ps(&bounds.min_y[i]), max_y, _CMP_LE_OQ));
+            compact(_mm256_movemask_ps(_mm256_and_ps(x, y)), 8, static_cast<int>(i), out, count);
+        }
+        return count + find_overlaps_sse2(bounds, i, end, box, out + count);
+    }
+#else
+    size_t find_overlaps_sse2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out) { return find_overlaps_scalar(bounds, begin, end, box, out); }
+    size_t find_overlaps_avx2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out) { return find_overlaps_scalar(bounds, begin, end, box, out); }
+#endif
+}
+
+namespace broadphase
+{
+    size_t find_overlaps(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out)
+    {
+        static const auto kernel = detail::cpu_supports_avx2() ? detail::find_overlaps_avx2 : detail::find_overlaps_sse2;
+        return kernel(bounds, begin, end, box, out);
+    }
+
+    int sweep_and_prune::create_proxy(const aabb & box)
+    {
+        int proxy = static_cast<int>(boxes.size());
+        if(free_proxies.empty()) boxes.push_back(box);
+        else
+        {
+            proxy = free_proxies.back();
+            free_proxies.pop_back();
+            boxes[proxy] = box;
+        }
+
+        // New proxies are appended, and will be merged into place on the next call to find_pairs
+        sorted.push_back(proxy);
+        return proxy;
+    }
+
+    void sweep_and_prune::destroy_proxy(int proxy)
+    {
+        const auto it = std::find(begin(sorted), end(sorted), proxy);
+        if(static_cast<size_t>(it - begin(sorted)) < sorted_count) --sorted_count;
+        sorted.erase(it);
+        free_proxies.push_back(proxy);
+    }
+
+    void sweep_and_prune::find_pairs(std::vector<pair> & pairs)
+    {
+        // Restore sorted order, which should require very few swaps if proxies have not moved much since the last call
+        for(size_t i=1; i<sorted_count; ++i)
+        {
+            const int proxy = sorted[i];
+            const float x = boxes[proxy].min.x;
+            size_t j = i;
+            for(; j>0 && boxes[sorted[j-1]].min.x > x; --j) sorted[j] = sorted[j-1];
+            sorted[j] = proxy;
+        }
+
+        // Proxies created since the last call may be in any order, so sort them separately and merge them in
+        auto by_min_x = [this](int a, int b) { return boxes[a].min.x < boxes[b].min.x; };
+        std::sort(begin(sorted) + sorted_count, end(sorted), by_min_x);
+        std::inplace_merge(begin(sorted), begin(sorted) + sorted_count, end(sorted), by_min_x);
+        sorted_count = sorted.size();
+
+        // Gather bounds in sorted order, so that the candidates for each proxy are contiguous
+        sorted_bounds.resize(sorted.size());
+        for(size_t i=0; i<sorted.size(); ++i) sorted_bounds.set(i, boxes[sorted[i]]);
+        overlaps.resize(sorted.size());
+
+        // Sweep along the x axis, testing each proxy against the proxies whose lower bound lies within the current proxy's x interval
+        pairs.clear();
+        for(size_t i=0; i<sorted.size(); ++i)
+        {
+            const aabb & a = boxes[sorted[i]];
+            const auto & min_x = sorted_bounds.min_x;
+            const size_t last = std::upper_bound(begin(min_x) + i + 1, end(min_x), a.max.x) - begin(min_x);
+            const size_t count = find_overlaps(sorted_bounds, i+1, last, a, overlaps.data());
+            for(size_t j=0; j<count; ++j) pairs.push_back({std::min(sorted[i], sorted[overlaps[j]]), std::max(sorted[i], sorted[overlaps[j]])});
+        }
+
+        stats = {sorted.size(), pairs.size(), sorted.size()*(sorted.size()-1)/2};
+    }
+}
@@ -0,0 +1,90 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "linalg.h"
+using namespace linalg::aliases;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BROADPHASE_SSE2 // SSE2 is always available on x64, and on x86 when the compiler is allowed to assume it
+#endif
+
+namespace broadphase
+{
+    struct aabb { float2 min, max; };
+    inline bool overlaps(const aabb & a, const aabb & b) { return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y; }
+    inline bool contains(const aabb & outer, const aabb & inner) { return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y; }
+    inline aabb combine(const aabb & a, const aabb & b) { return {min(a.min, b.min), max(a.max, b.max)}; }
+    inline aabb expand(const aabb & a, float margin) { return {a.min - margin, a.max + margin}; }
+    inline float perimeter(const aabb & a) { return 2*(a.max.x - a.min.x + a.max.y - a.min.y); }
+
+    // Returns the first t in [0, max_t] for which the ray origin + direction*t intersects the box, or infinity if there is none. 
+    // inv_direction is the reciprocal of the ray direction.
+    inline float find_ray_entry(const aabb & a, const float2 & origin, const float2 & inv_direction, float max_t)
+    {
+        const float2 t0 = (a.min - origin) * inv_direction, t1 = (a.max - origin) * inv_direction;
+        const float2 t_near = min(t0, t1), t_far = max(t0, t1);
+        const float t_enter = std::max(maxelem(t_near), 0.0f);
+        return t_enter <= std::min(minelem(t_far), max_t) ? t_enter : std::numeric_limits<float>::infinity();
+    }
+    inline bool intersects_ray(const aabb & a, const float2 & origin, const float2 & inv_direction, float max_t) { return find_ray_entry(a, origin, inv_direction, max_t) <= max_t; }
+
+    // Axis-aligned bounds for a set of boxes, stored as a structure of arrays
+    struct bounds_array
+    {
+        std::vector<float> min_x, min_y, max_x, max_y;
+
+        size_t size() const { return min_x.size(); }
+        void resize(size_t n) { min_x.resize(n); min_y.resize(n); max_x.resize(n); max_y.resize(n); }
+        aabb get(size_t i) const { return {{min_x[i], min_y[i]}, {max_x[i], max_y[i]}}; }
+        void set(size_t i, const aabb & box) { min_x[i] = box.min.x; min_y[i] = box.min.y; max_x[i] = box.max.x; max_y[i] = box.max.y; }
+    };
+
+    // Writes the index of every box in [begin,end) which overlaps box to out, which must have room for end-begin indices, and returns 
+    // the number of indices written. Uses the widest SIMD instruction set supported by the CPU.
+    size_t find_overlaps(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out);
+
+    // Every broadphase (sweep_and_prune, aabb_tree, spatial_hash, hierarchical_grid) provides create_proxy, destroy_proxy, move_proxy, 
+    // get_bounds, find_pairs and get_stats with the same signatures, so they can be used interchangeably.
+
+    // A pair of proxies whose bounds overlap, always ordered such that a < b
+    struct pair { int a, b; };
+    struct pair_stats 
+    { 
+        size_t proxies, candidate_pairs, total_pairs;
+        float pruning_ratio() const { return total_pairs ? 1 - (float)candidate_pairs/total_pairs : 0; }
+    };
+
+    // Persistent sweep-and-prune along the x axis. Proxies are kept sorted by the lower bound of their AABB using insertion sort,
+    // which runs in close to linear time when bodies move coherently from frame to frame.
+    class sweep_and_prune
+    {
+        std::vector<aabb> boxes;        // Indexed by proxy ID
+        std::vector<int> free_proxies;  // Proxy IDs available for reuse
+        std::vector<int> sorted;        // Live proxy IDs, in order of increasing boxes[id].min.x
+        size_t sorted_count = 0;        // Number of proxies at the front of sorted which were present during the last call to find_pairs
+        bounds_array sorted_bounds;     // Bounds of each proxy in sorted, used for SIMD overlap tests
+        std::vector<int> overlaps;      // Scratch space for the results of overlap tests
+        pair_stats stats {};
+    public:
+        int create_proxy(const aabb & box);
+        void destroy_proxy(int proxy);
+        void move_proxy(int proxy, const aabb & box) { boxes[proxy] = box; }
+        const aabb & get_bounds(int proxy) const { return boxes[proxy]; }
+
+        // Replaces the contents of pairs with all pairs of proxies whose bounds overlap
+        void find_pairs(std::vector<pair> & pairs);
+        const pair_stats & get_stats() const { return stats; }
+    };
+
+    // Implementation details
+    namespace detail
+    {
+        bool cpu_supports_avx2();
+        size_t find_overlaps_scalar(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out);
+        size_t find_overlaps_sse2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out);
+        size_t find_overlaps_avx2(const bounds_array & bounds, size_t begin, size_t end, const aabb & box, int * out);
+    }
+}
@@ -2,6 +2,12 @@
 // For more information, please refer to <http://unlicense.org/>
 #include "collision.h"
 #include <algorithm>
+#include <limits>
+#include <cmath>
+#ifdef COLLISION_SSE2
+#include <immintrin.h>
+#include "broadphase.h"
+#endif
 
 namespace collision::detail
 {
@@ -32,48 +38,575 @@ namespace collision::detail
         std::terminate();
     }
 
-    static polytope_edge make_polytope_edge(const point & v0, const point & v1)
+    static std::tuple<simplex,point> reduce_edge(const point & a, const point & b)
     {
-        auto n = normalize(cross(v1.p - v0.p, 1.0f));
-        return {v0, v1, n, dot(v0.p,n)};
+        const float2 ab = b.p - a.p;
+        const float t = dot(ab,ab) > 0 ? dot(-a.p, ab) / dot(ab,ab) : 0;
+        if(t <= 0) return {{{a},1}, a};
+        if(t >= 1) return {{{b},1}, b};
+        return {{{a,b},2}, {lerp(a.p, b.p, t), lerp(a.point_on_a, b.point_on_a, t)}};
     }
 
-    // Convert a simplex to a polytope, enforcing consistent winding
-    std::vector<polytope_edge> make_polytope(const simplex & s)
+    std::tuple<simplex,point> reduce_simplex(const simplex & s)
     {
+        if(s.count == 1) return {s, s.points[0]};
+        if(s.count == 2) return reduce_edge(s.points[0], s.points[1]);
+
+        // If the origin is on the inner side of every edge, it is contained by the triangle, otherwise the closest point is on an edge
         const point & a = s.points[0], & b = s.points[1], & c = s.points[2];
-        if(cross(b.p-a.p,c.p-a.p) > 0) return {make_polytope_edge(a,b), make_polytope_edge(b,c), make_polytope_edge(c,a)};
-        return {make_polytope_edge(a,c), make_polytope_edge(c,b), make_polytope_edge(b,a)};
+        const float area = cross(b.p-a.p, c.p-a.p);
+        if(area != 0 && area*cross(b.p-a.p, -a.p) >= 0 && area*cross(c.p-b.p, -b.p) >= 0 && area*cross(a.p-c.p, -c.p) >= 0) return {s, {{0,0}, {0,0}}};
+        std::tuple<simplex,point> best = reduce_edge(a, b);
+        for(auto edge : {reduce_edge(b, c), reduce_edge(c, a)}) if(length2(std::get<1>(edge).p) < length2(std::get<1>(best).p)) best = edge;
+        return best;
+    }
+
+    polytope::polytope(const simplex & s) : vertex_count{3}, edge_count{0}, heap_size{0}, ring_size{3}
+    {
+        // Enforce counter-clockwise winding, so that edge normals face away from the origin
+        const bool ccw = cross(s.points[1].p-s.points[0].p, s.points[2].p-s.points[0].p) > 0;
+        vertices[0] = s.points[0];
+        vertices[1] = s.points[ccw ? 1 : 2];
+        vertices[2] = s.points[ccw ? 2 : 1];
+        for(int i=0; i<3; ++i) 
+        {
+            add_edge(i, (i+1)%3);
+            edges[i].prev = (i+2)%3;
+            edges[i].next = (i+1)%3;
+        }
     }
 
-    // Returns true if polytope was expanded to include point, false if point was already inside polytope
-    bool expand_polytope(std::vector<polytope_edge> & edges, point point)
+    int polytope::add_edge(int v0, int v1)
     {
-        // If point is inside polytope, we are done, otherwise remove edges which face the point
-        auto it = std::remove_if(begin(edges), end(edges), [point](const polytope_edge & edge) { return dot(edge.normal, point.p) > edge.distance; });
-        if(it == end(edges)) return false; // No edges removed, point is inside polytope
-        if(it == begin(edges)) return false; // ALL edges would be removed, polytope is degenerate and point is colinear with all edges
-        edges.erase(it, end(edges));
+        const int e = edge_count++;
+        const float2 n = normalize(cross(vertices[v1].p - vertices[v0].p, 1.0f));
+        edges[e] = {v0, v1, -1, -1, n, dot(vertices[v0].p, n), false};
+
+        // Sift the new edge up the heap
+        int i = heap_size++;
+        for(; i > 0 && edges[heap[(i-1)/2]].distance > edges[e].distance; i = (i-1)/2) heap[i] = heap[(i-1)/2];
+        heap[i] = e;
+        return e;
+    }
 
-        // There is now a break somewhere in the list, find it and fill it with two new edges, including our new point
-        edges.push_back(edges.front());
-        for(size_t i=1; i<edges.size(); ++i)
+    int polytope::nearest_edge()
+    {
+        // Discard edges which have been cut from the ring, by moving the last element to the root and sifting it down
+        while(edges[heap[0]].removed)
         {
-            if(edges[i-1].v1.p != edges[i].v0.p)
+            const int last = heap[--heap_size];
+            int i = 0;
+            while(true)
             {
-                edges.insert(edges.begin() + i, {make_polytope_edge(edges[i-1].v1, point), make_polytope_edge(point, edges[i].v0)});
-                break;
+                int child = 2*i+1;
+                if(child >= heap_size) break;
+                if(child+1 < heap_size && edges[heap[child+1]].distance < edges[heap[child]].distance) ++child;
+                if(edges[last].distance <= edges[heap[child]].distance) break;
+                heap[i] = heap[child];
+                i = child;
             }
+            heap[i] = last;
         }
-        edges.pop_back();  
+        return heap[0];
+    }
+
+    bool polytope::expand(int edge, const point & p)
+    {
+        if(full()) return false;
+
+        // Edges which face the point are contiguous around the given edge, find the first and last of them
+        auto faces = [&](int e) { return dot(edges[e].normal, p.p) > edges[e].distance; };
+        if(!faces(edge)) return false; // Point is inside polytope
+        int first = edge, last = edge, removed = 1;
+        while(faces(edges[first].prev) && edges[first].prev != last) { first = edges[first].prev; ++removed; }
+        if(removed == ring_size) return false; // ALL edges would be removed, polytope is degenerate and point is colinear with all edges
+        while(faces(edges[last].next) && edges[last].next != first) { last = edges[last].next; ++removed; }
+        if(removed == ring_size) return false;
+
+        // Cut the facing edges from the ring and bridge the gap with two new edges, including our new point
+        for(int e=first; ; e=edges[e].next) 
+        {
+            edges[e].removed = true;
+            if(e == last) break;
+        }
+        const int prev = edges[first].prev, next = edges[last].next, v = vertex_count++;
+        vertices[v] = p;
+        const int a = add_edge(edges[first].v0, v), b = add_edge(v, edges[last].v1);
+        edges[a].prev = prev; edges[a].next = b;
+        edges[b].prev = a; edges[b].next = next;
+        edges[prev].next = a;
+        edges[next].prev = b;
+        ring_size += 2 - removed;
         return true;
     }
 
     // Returns penetration data using the nearest edge to the origin from a fully expanded polytope
-    penetration penetration_from_nearest_edge(const polytope_edge & edge)
+    penetration polytope::get_penetration(int edge) const
+    {
+        const auto & e = edges[edge];
+        const point & v0 = vertices[e.v0], & v1 = vertices[e.v1];
+        const float2 p = e.normal * e.distance, ab = v1.p - v0.p;
+        const float t = dot(p - v0.p, ab) / dot(ab,ab);
+        return {lerp(v0.point_on_a, v1.point_on_a, t), e.normal, e.distance};
+    }
+}
+
+namespace collision
+{
+    narrowphase_stats & narrowphase_stats::operator += (const narrowphase_stats & s)
+    {
+        gjk_queries += s.gjk_queries;
+        gjk_iterations += s.gjk_iterations;
+        gjk_duplicate_exits += s.gjk_duplicate_exits;
+        epa_queries += s.epa_queries;
+        epa_expansions += s.epa_expansions;
+        epa_edge_cap_exits += s.epa_edge_cap_exits;
+        epa_degenerate_exits += s.epa_degenerate_exits;
+        return *this;
+    }
+
+    std::optional<penetration> find_circle_circle_intersection(const float2 & center_a, float radius_a, const float2 & center_b, float radius_b)
+    {
+        const float2 delta = center_b - center_a;
+        const float dist = length(delta);
+        if(dist >= radius_a + radius_b) return std::nullopt;
+        const float2 n = dist > 0 ? delta/dist : float2{1,0};
+        return penetration{center_a + n*radius_a, n, radius_a + radius_b - dist};
+    }
+
+    std::optional<penetration> find_circle_segment_intersection(const float2 & center, float radius, const float2 & p0, const float2 & p1)
+    {
+        const float2 edge = p1 - p0;
+        const float edge2 = dot(edge, edge);
+        const float2 closest = edge2 > 0 ? p0 + edge * std::min(std::max(dot(center - p0, edge) / edge2, 0.0f), 1.0f) : p0;
+        const float dist = distance(center, closest);
+        if(dist >= radius) return std::nullopt;
+        const float2 n = dist > 0 ? (closest - center)/dist : edge2 > 0 ? normalize(cross(edge, 1.0f)) : float2{1,0};
+        return penetration{center + n*radius, n, radius - dist};
+    }
+
+    static float2 rotate(const float2 & rotation, const float2 & v) { return {rotation.x*v.x - rotation.y*v.y, rotation.y*v.x + rotation.x*v.y}; }
+
+    std::optional<penetration> find_circle_box_intersection(const float2 & center, float radius, const float2 & box_position, const float2 & box_rotation, const float2 & box_half_extent)
+    {
+        const float2 local = rotate(box_rotation * float2{1,-1}, center - box_position);
+        const float2 closest = clamp(local, -box_half_extent, box_half_extent);
+        float2 n;
+        float d;
+        if(local != closest)
+        {
+            // Center is outside the box, so the contact is between the circle and the closest point on the box
+            const float dist = distance(local, closest);
+            if(dist >= radius) return std::nullopt;
+            n = (closest - local)/dist;
+            d = radius - dist;
+        }
+        else
+        {
+            // Center is inside the box, so push the circle out through the nearest face
+            const float2 gap = box_half_extent - abs(local);
+            const int axis = gap.x < gap.y ? 0 : 1;
+            n = {0,0};
+            n[axis] = local[axis] < 0 ? 1.0f : -1.0f;
+            d = radius + gap[axis];
+        }
+        n = rotate(box_rotation, n);
+        return penetration{center + n*radius, n, d};
+    }
+
+    static float2 project(const float2 * points, int count, const float2 & axis)
+    {
+        float lo = dot(points[0], axis), hi = lo;
+        for(int i=1; i<count; ++i) 
+        {
+            const float d = dot(points[i], axis);
+            lo = std::min(lo, d);
+            hi = std::max(hi, d);
+        }
+        return {lo, hi};
+    }
+
+    static const float2 & support_point(const float2 * points, int count, const float2 & direction)
+    {
+        int best = 0;
+        for(int i=1; i<count; ++i) if(dot(points[i], direction) > dot(points[best], direction)) best = i;
+        return points[best];
+    }
+
+    std::optional<penetration> find_polygon_intersection(const float2 * points_a, int count_a, const float2 * points_b, int count_b)
+    {
+        // Find the edge normal of either polygon along which the polygons overlap the least
+        float best_depth = std::numeric_limits<float>::infinity();
+        float2 best_normal;
+        bool best_from_a = false;
+        for(int poly=0; poly<2; ++poly)
+        {
+            const float2 * points = poly ? points_b : points_a;
+            const int count = poly ? count_b : count_a;
+            for(int i=0; i<count; ++i)
+            {
+                const float2 edge = points[(i+1)%count] - points[i];
+                if(edge == float2{0,0}) continue; // Skip repeated vertices
+                const float2 axis = normalize(cross(edge, 1.0f));
+                const float2 range_a = project(points_a, count_a, axis), range_b = project(points_b, count_b, axis);
+                const float forward = range_a.y - range_b.x, backward = range_b.y - range_a.x; // Overlap if B is moved along +axis or -axis respectively
+                if(forward < 0 || backward < 0) return std::nullopt;
+                if(std::min(forward, backward) < best_depth)
+                {
+                    best_depth = std::min(forward, backward);
+                    best_normal = forward < backward ? axis : -axis;
+                    best_from_a = poly == 0;
+                }
+            }
+        }
+        if(!std::isfinite(best_depth)) return std::nullopt;
+
+        // If the axis is a face normal of B, the deepest point is a vertex of A, and vice versa
+        if(best_from_a)
+        {
+            const float2 point_on_b = support_point(points_b, count_b, -best_normal);
+            return penetration{point_on_b + best_normal*best_depth, best_normal, best_depth};
+        }
+        return penetration{support_point(points_a, count_a, best_normal), best_normal, best_depth};
+    }
+
+    feature_edge find_feature_edge(const float2 & prev, const float2 & vertex, const float2 & next, int index, int count, const float2 & direction)
+    {
+        const float2 to_prev = normalize(vertex - prev), to_next = normalize(next - vertex);
+        if(std::abs(dot(to_prev, direction)) <= std::abs(dot(to_next, direction))) return {prev, vertex, (index+count-1)%count};
+        return {vertex, next, index};
+    }
+
+    feature_edge find_feature_edge(const float2 * points, int count, const float2 & direction)
+    {
+        int best = 0;
+        for(int i=1; i<count; ++i) if(dot(points[i], direction) > dot(points[best], direction)) best = i;
+        return find_feature_edge(points[(best+count-1)%count], points[best], points[(best+1)%count], best, count, direction);
+    }
+
+    // Clips a segment to the half-plane dot(normal, p) >= offset, returning the number of points which remain. Order is preserved.
+    static int clip(float2 (&points)[2], const float2 & normal, float offset)
+    {
+        const float d0 = dot(normal, points[0]) - offset, d1 = dot(normal, points[1]) - offset;
+        if(d0 < 0 && d1 < 0) return 0;
+        if(d0 < 0) points[0] = lerp(points[0], points[1], d0/(d0-d1));
+        else if(d1 < 0) points[1] = lerp(points[0], points[1], d0/(d0-d1));
+        return 2;
+    }
+
+    // Edge indices get 14 bits each of a contact ID, so IDs stay distinct for polygons of up to 16384 vertices, and the top two bits stay 
+    // clear to keep them apart from unmatched_contact_id
+    static uint32_t feature_id(int index) { return uint32_t(index) & 0x3fff; }
+
+    // If clipping leaves fewer than two points, the edges are too far from parallel to form a manifold, and the single contact is used instead
+    manifold find_manifold(const feature_edge & edge_a, const feature_edge & edge_b, const penetration & contact, float max_distance)
+    {
+        const float2 n = contact.normal_a_to_b();
+        const bool flip = std::abs(dot(normalize(edge_b.v1 - edge_b.v0), n)) < std::abs(dot(normalize(edge_a.v1 - edge_a.v0), n));
+        const feature_edge & ref = flip ? edge_b : edge_a, & inc = flip ? edge_a : edge_b;
+
+        // Clip the incident edge against both side planes of the reference edge
+        const float2 side = normalize(ref.v1 - ref.v0);
+        const float2 ref_normal = dot(cross(side, 1.0f), flip ? -n : n) < 0 ? -cross(side, 1.0f) : cross(side, 1.0f); // Face normal, from reference to incident, used in place of the less stable query normal
+        const float2 normal = flip ? -ref_normal : ref_normal;
+        float2 clipped[2] {inc.v0, inc.v1};
+        if(clip(clipped, side, dot(side, ref.v0)) < 2 || clip(clipped, -side, -dot(side, ref.v1)) < 2) return {{contact}, {unmatched_contact_id}, 1};
+
+        // Keep points which are behind, or within max_distance in front of, the reference edge
+        manifold m {};
+        const float face = dot(ref_normal, ref.v0);
+        for(int i=0; i<2; ++i)
+        {
+            const float depth = face - dot(ref_normal, clipped[i]);
+            if(depth < -max_distance) continue;
+            m.points[m.count] = {flip ? clipped[i] : clipped[i] + normal*depth, normal, depth};
+            m.ids[m.count++] = feature_id(ref.index) << 16 | feature_id(inc.index) << 2 | uint32_t(i) << 1 | (flip ? 1 : 0);
+        }
+        if(m.count == 0) return {{contact}, {unmatched_contact_id}, 1};
+        return m;
+    }
+
+    manifold find_polygon_manifold(const float2 * points_a, int count_a, const float2 * points_b, int count_b, const penetration & contact, float max_distance)
+    {
+        const float2 n = contact.normal_a_to_b();
+        return find_manifold(find_feature_edge(points_a, count_a, n), find_feature_edge(points_b, count_b, -n), contact, max_distance);
+    }
+}
+
+namespace collision
+{
+    void circle_batch::push_back(const float2 & center, float r)
+    {
+        if(count % 4 == 0)
+        {
+            center_x.resize(count+4);
+            center_y.resize(count+4);
+            radius.resize(count+4);
+        }
+        center_x[count] = center.x;
+        center_y[count] = center.y;
+        radius[count++] = r;
+    }
+
+    void polygon_batch::push_back(const float2 * points)
+    {
+        if(count % 4 == 0)
+        {
+            x.resize((count+4)*vertex_count);
+            y.resize((count+4)*vertex_count);
+        }
+        for(int j=0; j<vertex_count; ++j)
+        {
+            const size_t k = ((count/4)*vertex_count + j)*4 + count%4;
+            x[k] = points[j].x;
+            y[k] = points[j].y;
+        }
+        ++count;
+    }
+
+    float2 polygon_batch::support(size_t i, const float2 & direction) const
+    {
+        float2 best = get_vertex(i, 0);
+        float best_d = dot(best, direction);
+        for(int j=1; j<vertex_count; ++j)
+        {
+            const float2 v = get_vertex(i, j);
+            const float d = dot(v, direction);
+            if(d > best_d)
+            {
+                best = v;
+                best_d = d;
+            }
+        }
+        return best;
+    }
+}
+
+#ifdef COLLISION_SSE2
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2"), flatten)) // Flatten inlines the kernel, written for any lane width, as AVX2 code
+#pragma GCC diagnostic ignored "-Wpsabi" // AVX2 registers never cross a call, as the AVX2 kernel is always flattened into its entry point
+#endif
+namespace collision::detail
+{
+    // Operations on four lanes using SSE2, or eight using AVX2, so that the batched GJK below is written once for both. Loads of eight 
+    // lanes from a batch take two consecutive blocks of four, which are block_stride floats apart.
+    struct sse2_lanes
+    {
+        using reg = __m128;
+        static constexpr int width = 4;
+        static reg set1(float a) { return _mm_set1_ps(a); }
+        static reg load(const float * p, size_t) { return _mm_loadu_ps(p); }
+        static void store(float * p, const reg & a) { _mm_storeu_ps(p, a); }
+        static reg add(const reg & a, const reg & b) { return _mm_add_ps(a, b); }
+        static reg sub(const reg & a, const reg & b) { return _mm_sub_ps(a, b); }
+        static reg mul(const reg & a, const reg & b) { return _mm_mul_ps(a, b); }
+        static reg div(const reg & a, const reg & b) { return _mm_div_ps(a, b); }
+        static reg sqrt(const reg & a) { return _mm_sqrt_ps(a); }
+        static reg bit_and(const reg & a, const reg & b) { return _mm_and_ps(a, b); }
+        static reg bit_or(const reg & a, const reg & b) { return _mm_or_ps(a, b); }
+        static reg and_not(const reg & a, const reg & b) { return _mm_andnot_ps(a, b); } // ~a & b
+        static reg bit_xor(const reg & a, const reg & b) { return _mm_xor_ps(a, b); }
+        static reg less(const reg & a, const reg & b) { return _mm_cmplt_ps(a, b); }
+        static reg greater(const reg & a, const reg & b) { return _mm_cmpgt_ps(a, b); }
+        static reg greater_equal(const reg & a, const reg & b) { return _mm_cmpge_ps(a, b); }
+        static reg not_greater(const reg & a, const reg & b) { return _mm_cmpngt_ps(a, b); }
+        static reg equal(const reg & a, const reg & b) { return _mm_cmpeq_ps(a, b); }
+        static int mask(const reg & a) { return _mm_movemask_ps(a); }
+    };
+    struct avx2_lanes
+    {
+        using reg = __m256;
+        static constexpr int width = 8;
+        TARGET_AVX2 static reg set1(float a) { return _mm256_set1_ps(a); }
+        TARGET_AVX2 static reg load(const float * p, size_t block_stride) { return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + block_stride), 1); }
+        TARGET_AVX2 static void store(float * p, const reg & a) { _mm256_storeu_ps(p, a); }
+        TARGET_AVX2 static reg add(const reg & a, const reg & b) { return _mm256_add_ps(a, b); }
+        TARGET_AVX2 static reg sub(const reg & a, const reg & b) { return _mm256_sub_ps(a, b); }
+        TARGET_AVX2 static reg mul(const reg & a, const reg & b) { return _mm256_mul_ps(a, b); }
+        TARGET_AVX2 static reg div(const reg & a, const reg & b) { return _mm256_div_ps(a, b); }
+        TARGET_AVX2 static reg sqrt(const reg & a) { return _mm256_sqrt_ps(a); }
+        TARGET_AVX2 static reg bit_and(const reg & a, const reg & b) { return _mm256_and_ps(a, b); }
+        TARGET_AVX2 static reg bit_or(const reg & a, const reg & b) { return _mm256_or_ps(a, b); }
+        TARGET_AVX2 static reg and_not(const reg & a, const reg & b) { return _mm256_andnot_ps(a, b); }
+        TARGET_AVX2 static reg bit_xor(const reg & a, const reg & b) { return _mm256_xor_ps(a, b); }
+        TARGET_AVX2 static reg less(const reg & a, const reg & b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        TARGET_AVX2 static reg greater(const reg & a, const reg & b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        TARGET_AVX2 static reg greater_equal(const reg & a, const reg & b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        TARGET_AVX2 static reg not_greater(const reg & a, const reg & b) { return _mm256_cmp_ps(a, b, _CMP_NGT_UQ); }
+        TARGET_AVX2 static reg equal(const reg & a, const reg & b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        TARGET_AVX2 static int mask(const reg & a) { return _mm256_movemask_ps(a); }
+    };
+
+    template<class V> static typename V::reg select(const typename V::reg & mask, const typename V::reg & a, const typename V::reg & b) { return V::bit_or(V::bit_and(mask, a), V::and_not(mask, b)); }
+    template<class V> static typename V::reg neg(const typename V::reg & a) { return V::bit_xor(a, V::set1(-0.0f)); }
+    template<class V> static typename V::reg dot(const typename V::reg & ax, const typename V::reg & ay, const typename V::reg & bx, const typename V::reg & by) { return V::add(V::mul(ax, bx), V::mul(ay, by)); }
+    template<class V> static typename V::reg cross(const typename V::reg & ax, const typename V::reg & ay, const typename V::reg & bx, const typename V::reg & by) { return V::sub(V::mul(ax, by), V::mul(ay, bx)); }
+
+    // Support points of the shapes in the lanes beginning at index i
+    template<class V> static void support_lanes(const circle_batch & c, size_t i, const typename V::reg & dx, const typename V::reg & dy, typename V::reg & x, typename V::reg & y)
     {
-        const float2 p = edge.normal * edge.distance, ab = edge.v1.p - edge.v0.p;
-        const float t = dot(p - edge.v0.p, ab) / dot(ab,ab);
-        return {lerp(edge.v0.point_on_a, edge.v1.point_on_a, t), edge.normal, edge.distance};
+        const typename V::reg len = V::sqrt(dot<V>(dx, dy, dx, dy)), r = V::load(&c.radius[i], 4);
+        x = V::add(V::load(&c.center_x[i], 4), V::mul(V::div(dx, len), r));
+        y = V::add(V::load(&c.center_y[i], 4), V::mul(V::div(dy, len), r));
     }
+    template<class V> static void support_lanes(const polygon_batch & p, size_t i, const typename V::reg & dx, const typename V::reg & dy, typename V::reg & x, typename V::reg & y)
+    {
+        const float * px = &p.x[i*p.vertex_count], * py = &p.y[i*p.vertex_count];
+        const size_t block_stride = p.vertex_count*4;
+        x = V::load(px, block_stride);
+        y = V::load(py, block_stride);
+        typename V::reg best = dot<V>(x, y, dx, dy);
+        for(int j=1; j<p.vertex_count; ++j)
+        {
+            const typename V::reg vx = V::load(px+j*4, block_stride), vy = V::load(py+j*4, block_stride), d = dot<V>(vx, vy, dx, dy), m = V::greater(d, best);
+            best = select<V>(m, d, best);
+            x = select<V>(m, vx, x);
+            y = select<V>(m, vy, y);
+        }
+    }
+
+    // Point of the Minkowski difference A-B, and the point on A it came from, for each lane
+    template<class V> struct point_lanes { typename V::reg x, y, ax, ay; };
+    template<class V, class BatchA, class BatchB> static point_lanes<V> support_lanes(const BatchA & a, const BatchB & b, size_t i, const typename V::reg & dx, const typename V::reg & dy)
+    {
+        point_lanes<V> p;
+        typename V::reg bx, by;
+        support_lanes<V>(a, i, dx, dy, p.ax, p.ay);
+        support_lanes<V>(b, i, neg<V>(dx), neg<V>(dy), bx, by);
+        p.x = V::sub(p.ax, bx);
+        p.y = V::sub(p.ay, by);
+        return p;
+    }
+
+    // Search direction towards the origin from edge AB, equivalent to cross(cross(a, b-a), b-a)
+    template<class V> static void edge_direction(const point_lanes<V> & a, const point_lanes<V> & b, typename V::reg & dx, typename V::reg & dy)
+    {
+        const typename V::reg abx = V::sub(b.x, a.x), aby = V::sub(b.y, a.y), k = cross<V>(a.x, a.y, abx, aby);
+        dx = neg<V>(V::mul(k, aby));
+        dy = V::mul(k, abx);
+    }
+
+    template<class V> static point get_lane(const point_lanes<V> & p, int lane)
+    {
+        float v[4][V::width];
+        V::store(v[0], p.x); V::store(v[1], p.y); V::store(v[2], p.ax); V::store(v[3], p.ay);
+        return {{v[0][lane], v[1][lane]}, {v[2][lane], v[3][lane]}};
+    }
+
+    // Runs the GJK of find_intersection_simplex on the pairs in the lanes beginning at index i, with the branches of next_simplex 
+    // evaluated for every lane and selected by mask. Lanes retire as they terminate, and the loop ends once all have. Returns a bitmask 
+    // of the lanes which intersect, and writes their terminating simplices.
+    template<class V, class BatchA, class BatchB> static int find_intersection_simplices(const BatchA & a, const BatchB & b, size_t i, simplex * simplices)
+    {
+        using reg = typename V::reg;
+        constexpr int max_iterations = 64; // Guards against lanes which cycle due to rounding, these are reported as not intersecting
+        const reg zero = V::set1(0), one = V::set1(1);
+        point_lanes<V> s0 = support_lanes<V>(a, b, i, one, zero), s1 = s0;
+        reg active = V::greater_equal(s0.x, zero), has_edge = zero; // Lanes where {1,0} is a separating axis are done immediately
+        reg dx = neg<V>(s0.x), dy = neg<V>(s0.y);
+        int hits = 0;
+        for(int iteration=0; iteration<max_iterations && V::mask(active); ++iteration)
+        {
+            const reg degenerate = V::not_greater(dot<V>(dx, dy, dx, dy), zero);
+            dx = select<V>(degenerate, neg<V>(one), dx);
+            dy = select<V>(degenerate, zero, dy);
+            const point_lanes<V> p = support_lanes<V>(a, b, i, dx, dy);
+            const reg separated = V::less(dot<V>(p.x, p.y, dx, dy), zero);
+            const reg repeated = V::bit_or(V::bit_and(V::equal(p.x, s0.x), V::equal(p.y, s0.y)), 
+                V::bit_and(has_edge, V::bit_and(V::equal(p.x, s1.x), V::equal(p.y, s1.y))));
+            active = V::and_not(V::bit_or(separated, repeated), active);
+
+            // Triangle case of next_simplex, with A = p, B = s0, C = s1
+            const reg abx = V::sub(s0.x, p.x), aby = V::sub(s0.y, p.y), acx = V::sub(s1.x, p.x), acy = V::sub(s1.y, p.y);
+            const reg abc = cross<V>(abx, aby, acx, acy);
+            const reg outside_ac = V::less(dot<V>(neg<V>(V::mul(abc, acy)), V::mul(abc, acx), p.x, p.y), zero);
+            const reg toward_ac = V::less(dot<V>(acx, acy, p.x, p.y), zero);
+            const reg inside_ab = V::greater_equal(dot<V>(V::mul(aby, abc), neg<V>(V::mul(abx, abc)), p.x, p.y), zero);
+            const reg inside = V::bit_and(active, V::bit_and(has_edge, V::and_not(outside_ac, inside_ab)));
+            if(const int mask = V::mask(inside))
+            {
+                for(int lane=0; lane<V::width; ++lane) if(mask & 1 << lane) simplices[lane] = {{get_lane(p, lane), get_lane(s0, lane), get_lane(s1, lane)}, 3};
+                hits |= mask;
+                active = V::and_not(inside, active);
+            }
+            const reg use_ac = V::bit_and(has_edge, V::bit_and(outside_ac, toward_ac));
+
+            // Edge case of next_simplex, with A = p, B = s0
+            const reg use_ab = V::less(dot<V>(abx, aby, p.x, p.y), zero);
+            reg ab_dx, ab_dy, ac_dx, ac_dy;
+            edge_direction(p, s0, ab_dx, ab_dy);
+            edge_direction(p, s1, ac_dx, ac_dy);
+            dx = select<V>(use_ac, ac_dx, select<V>(use_ab, ab_dx, neg<V>(p.x)));
+            dy = select<V>(use_ac, ac_dy, select<V>(use_ab, ab_dy, neg<V>(p.y)));
+            has_edge = V::bit_or(use_ac, use_ab);
+            s1 = {select<V>(use_ac, s1.x, s0.x), select<V>(use_ac, s1.y, s0.y), select<V>(use_ac, s1.ax, s0.ax), select<V>(use_ac, s1.ay, s0.ay)};
+            s0 = p;
+        }
+        return hits;
+    }
+    template<class BatchA, class BatchB> TARGET_AVX2 static int find_intersection_simplices_avx2(const BatchA & a, const BatchB & b, size_t i, simplex * simplices)
+    {
+        return find_intersection_simplices<avx2_lanes>(a, b, i, simplices);
+    }
+}
+#endif
+
+namespace collision
+{
+    template<class BatchA, class BatchB> static auto batch_support_function(const BatchA & a, const BatchB & b, size_t i)
+    {
+        return detail::minkowski_difference([&a,i](const float2 & d) { return a.support(i, d); }, [&b,i](const float2 & d) { return b.support(i, d); });
+    }
+
+    // Calls on_hit(i, simplex) for each pair of the batches which intersects
+    template<class BatchA, class BatchB, class F> static void for_each_intersection(const BatchA & a, const BatchB & b, F on_hit)
+    {
+        const size_t n = std::min(a.size(), b.size());
+#ifdef COLLISION_SSE2
+        // Eight lanes at a time while both blocks of four exist, as storage is only padded to a whole block, then four for any last block
+        static const bool avx2 = broadphase::detail::cpu_supports_avx2();
+        detail::simplex simplices[8];
+        size_t i = 0;
+        if(avx2) for(; i+4 < n; i+=8)
+        {
+            const int hits = detail::find_intersection_simplices_avx2(a, b, i, simplices);
+            for(size_t lane=0; lane<8 && i+lane<n; ++lane) if(hits & 1 << lane) on_hit(i+lane, simplices[lane]);
+        }
+        for(; i<n; i+=4)
+        {
+            const int hits = detail::find_intersection_simplices<detail::sse2_lanes>(a, b, i, simplices);
+            for(size_t lane=0; lane<4 && i+lane<n; ++lane) if(hits & 1 << lane) on_hit(i+lane, simplices[lane]);
+        }
+#else
+        for(size_t i=0; i<n; ++i)
+        {
+            gjk_cache cache;
+            if(auto s = detail::find_intersection_simplex(batch_support_function(a, b, i), cache)) on_hit(i, *s);
+        }
+#endif
+    }
+
+    template<class BatchA, class BatchB> static void check_intersections(const BatchA & a, const BatchB & b, bool * results)
+    {
+        std::fill_n(results, std::min(a.size(), b.size()), false);
+        for_each_intersection(a, b, [results](size_t i, const detail::simplex &) { results[i] = true; });
+    }
+
+    template<class BatchA, class BatchB> static void find_intersections(const BatchA & a, const BatchB & b, std::optional<penetration> * results, float epsilon)
+    {
+        std::fill_n(results, std::min(a.size(), b.size()), std::nullopt);
+        for_each_intersection(a, b, [&](size_t i, const detail::simplex & s)
+        {
+            gjk_cache cache;
+            results[i] = detail::find_penetration(batch_support_function(a, b, i), s, cache, epsilon);
+        });
+    }
+
+    void check_intersections(const polygon_batch & a, const polygon_batch & b, bool * results) { check_intersections<polygon_batch, polygon_batch>(a, b, results); }
+    void check_intersections(const circle_batch & a, const polygon_batch & b, bool * results) { check_intersections<circle_batch, polygon_batch>(a, b, results); }
+    void find_intersections(const polygon_batch & a, const polygon_batch & b, std::optional<penetration> * results, float epsilon) { find_intersections<polygon_batch, polygon_batch>(a, b, results, epsilon); }
+    void find_intersections(const circle_batch & a, const polygon_batch & b, std::optional<penetration> * results, float epsilon) { find_intersections<circle_batch, polygon_batch>(a, b, results, epsilon); }
 }
@@ -3,9 +3,21 @@
 #pragma once
 #include <vector>
 #include <optional>
+#include <cstdint>
 #include "linalg.h"
 using namespace linalg::aliases;
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLISION_SSE2 // SSE2 is always available on x64, and on x86 when the compiler is allowed to assume it
+#endif
+
+// Define COLLISION_STATS throughout the project to have queries count their work into gjk_cache::stats. Otherwise the counters compile away.
+#ifdef COLLISION_STATS
+#define COLLISION_COUNT(cache, counter) (++(cache).stats.counter)
+#else
+#define COLLISION_COUNT(cache, counter) ((void)0)
+#endif
+
 namespace collision
 {
     struct penetration
@@ -16,49 +28,344 @@ namespace collision
         float2 normal_a_to_b() const { return n; }
         float2 normal_b_to_a() const { return -n; }
         float penetration_depth() const { return d; }
+        penetration reversed() const { return {p-n*d, -n, d}; } // Penetration data with the roles of shapes A and B exchanged
+    };
+
+    struct separation
+    {
+        float2 p,n; float d;
+        float2 point_on_a() const { return p; }
+        float2 point_on_b() const { return p+n*d; }
+        float2 normal_a_to_b() const { return n; }
+        float2 normal_b_to_a() const { return -n; }
+        float distance() const { return d; }
+        penetration as_penetration() const { return {p, n, -d}; } // Penetration of negative depth, usable as a speculative contact
+    };
+
+    // Up to two contact points sharing a normal. Each point carries an ID built from the features (edges and vertices) which produced it, 
+    // which stays the same from frame to frame for as long as the same features remain in contact.
+    struct manifold
+    {
+        penetration points[2];
+        uint32_t ids[2];
+        int count;
+    };
+    constexpr uint32_t unmatched_contact_id = 0xffffffff; // ID of a single contact not produced by a pair of features, which no feature pair ID equals
+
+    // Work done by narrowphase queries, for finding the cause of spikes in narrowphase cost
+    struct narrowphase_stats
+    {
+        size_t gjk_queries;             // Runs of GJK, for intersection or distance
+        size_t gjk_iterations;          // Support evaluations made by GJK
+        size_t gjk_duplicate_exits;     // Runs of GJK ended by a support point which was already in the simplex
+        size_t epa_queries;             // Runs of EPA
+        size_t epa_expansions;          // Support points added to the polytope
+        size_t epa_edge_cap_exits;      // Runs of EPA ended by the polytope reaching its ring size limit or storage capacity
+        size_t epa_degenerate_exits;    // Runs of EPA ended by a support point which could not expand the polytope
+        narrowphase_stats & operator += (const narrowphase_stats & s);
+    };
+
+    // State carried between queries on the same pair of shapes. GJK begins searching along the direction on which the previous query
+    // terminated, which for resting or slowly moving pairs is usually still a separating axis, found with a single support evaluation.
+    struct gjk_cache
+    {
+        float2 direction {1,0}; // Search direction in the Minkowski difference A-B, updated by each query
+        int iterations = 0;     // Number of support evaluations performed by the last query
+        bool used_epa = false;  // Whether the last query ran EPA to find the penetration
+        int support_hints[2] {}; // Vertices from which the support functions of shapes A and B begin searching, if they hill-climb
+#ifdef COLLISION_STATS
+        narrowphase_stats stats {}; // Accumulated by every query using this cache
+#endif
     };
 
     template<class SupportFunctionA, class SupportFunctionB> bool check_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction);
-    template<class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction, float epsilon=0.0001f);
+    // Narrowphase engines for find_intersection. GJK finds whether the shapes intersect and EPA then finds the minimum penetration. Minkowski
+    // Portal Refinement (XenoCollide) instead finds the penetration along the line from an interior point of the Minkowski difference 
+    // through the origin, which for shallow contacts is usually close to the minimum and takes fewer support evaluations to find.
+    struct gjk_epa;
+    struct mpr;
+
+    template<class Engine=gjk_epa, class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction, float epsilon=0.0001f);
+    template<class Engine=gjk_epa, class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, gjk_cache & cache, float epsilon=0.0001f);
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<separation> find_separation(SupportFunctionA support_a, SupportFunctionB support_b, gjk_cache & cache, float epsilon=0.0001f); // Closest points, or nullopt if the shapes touch or overlap
+
+    // Penetration of two rounded shapes, each given as the support function of a convex core and the radius by which the core is expanded.
+    // While the cores are apart, this follows from the distance between them, so EPA runs only when the cores themselves overlap, starting
+    // from the simplex on which the distance query stopped. Surfaces less than max_distance apart give a penetration of negative depth.
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_rounded_intersection(SupportFunctionA core_a, float radius_a, SupportFunctionB core_b, float radius_b, gjk_cache & cache, float max_distance=0, float epsilon=0.0001f);
+
+    // Motion of a shape over an interval of time normalized to [0,1]: the displacement of its center of rotation, and a bound on how far
+    // any of its points moves due to rotation, which is the angle swept times the greatest distance of any point from that center
+    struct motion_bound { float2 displacement; float rotation_bound; };
+
+    // Time of impact by conservative advancement. Each argument maps a time in [0,1] to a support function for the shape at that time. 
+    // Returns a time at which the shapes are between target_distance/2 and target_distance apart, no later than the time at which they 
+    // first come within target_distance/2, or nullopt if they do not come within target_distance. Shapes which start within target_distance
+    // give 0 only if their displacements bring them closer along the normal between them, and nullopt if they are sliding past or apart.
+    // Also gives nullopt if the advancement has not converged after 32 steps, as when the shapes stay just beyond target_distance for long.
+    template<class PoseA, class PoseB> std::optional<float> find_time_of_impact(PoseA shape_a_at, const motion_bound & motion_a, PoseB shape_b_at, const motion_bound & motion_b, float target_distance, gjk_cache & cache);
+
+    // The first point at which a ray origin + direction*t for t in [0, max_t] touches a shape, or at which shape A translated by 
+    // translation*t touches shape B. Normal is the surface normal of the shape being hit, and is zero if the ray or shape starts inside it.
+    struct cast_hit { float t; float2 point, normal; };
+    template<class SupportFunction> std::optional<cast_hit> cast_ray(SupportFunction support, const float2 & origin, const float2 & direction, float max_t, float epsilon=0.0001f);
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<cast_hit> cast_shape(SupportFunctionA support_a, const float2 & translation, SupportFunctionB support_b, float max_t, float epsilon=0.0001f);
+
+    // Closed-form and separating axis solutions for common pairs of primitives, returning the same data as find_intersection
+    std::optional<penetration> find_circle_circle_intersection(const float2 & center_a, float radius_a, const float2 & center_b, float radius_b);
+    std::optional<penetration> find_circle_segment_intersection(const float2 & center, float radius, const float2 & p0, const float2 & p1);
+    std::optional<penetration> find_circle_box_intersection(const float2 & center, float radius, const float2 & box_position, const float2 & box_rotation, const float2 & box_half_extent); // Rotation as cos and sin
+    std::optional<penetration> find_polygon_intersection(const float2 * points_a, int count_a, const float2 * points_b, int count_b); // Polygons must be convex, with any winding
+
+    // An edge of a polygon, with an index identifying it within the polygon. The feature edge of a polygon in some direction is whichever 
+    // of the two edges adjacent to its support vertex is more perpendicular to that direction.
+    struct feature_edge { float2 v0, v1; int index; };
+    feature_edge find_feature_edge(const float2 * points, int count, const float2 & direction);
+    feature_edge find_feature_edge(const float2 & prev, const float2 & vertex, const float2 & next, int index, int count, const float2 & direction); // Given the support vertex and its neighbours
+
+    // Builds a manifold for convex polygons in contact, given the contact found by any of the queries above and the feature edges of A and
+    // B along and against its normal. The incident edge is clipped against the side planes of the reference edge, which is whichever of
+    // the two is more perpendicular. Points separated by more than max_distance are discarded. Segments may be passed as polygons of two points.
+    manifold find_manifold(const feature_edge & edge_a, const feature_edge & edge_b, const penetration & contact, float max_distance=0);
+    manifold find_polygon_manifold(const float2 * points_a, int count_a, const float2 * points_b, int count_b, const penetration & contact, float max_distance=0);
+
+    // Batches of shapes of a single type, stored in blocks of four with each coordinate of a block contiguous, so that the batched
+    // queries below can process four pairs at once, or eight from two blocks. Storage is padded to a whole number of blocks.
+    struct circle_batch
+    {
+        std::vector<float> center_x, center_y, radius;
+        size_t count = 0;
+
+        size_t size() const { return count; }
+        void clear() { center_x.clear(); center_y.clear(); radius.clear(); count = 0; }
+        void push_back(const float2 & center, float radius);
+        float2 support(size_t i, const float2 & direction) const { return float2{center_x[i], center_y[i]} + normalize(direction) * radius[i]; }
+    };
+    struct polygon_batch
+    {
+        int vertex_count;                   // Shared by every polygon in the batch
+        std::vector<float> x, y;            // Vertex j of polygon i is found at index ((i/4)*vertex_count + j)*4 + i%4
+        size_t count = 0;
+
+        explicit polygon_batch(int vertex_count) : vertex_count{vertex_count} {}
+        size_t size() const { return count; }
+        void clear() { x.clear(); y.clear(); count = 0; }
+        void push_back(const float2 * points); // Points must form a convex polygon, with any winding
+        float2 get_vertex(size_t i, int j) const { const size_t k = ((i/4)*vertex_count + j)*4 + i%4; return {x[k], y[k]}; }
+        float2 support(size_t i, const float2 & direction) const;
+    };
+
+    // Batched versions of check_intersection and find_intersection for pairs (a[i], b[i]), searching initially along {1,0}. 
+    // GJK runs on eight pairs at a time using AVX2, or four using SSE2, depending on the CPU. EPA then runs on each pair found to intersect
+    // in turn, and dominates the cost of find_intersections, so batching mostly pays off for check_intersections.
+    void check_intersections(const polygon_batch & a, const polygon_batch & b, bool * results);
+    void check_intersections(const circle_batch & a, const polygon_batch & b, bool * results);
+    void find_intersections(const polygon_batch & a, const polygon_batch & b, std::optional<penetration> * results, float epsilon=0.0001f);
+    void find_intersections(const circle_batch & a, const polygon_batch & b, std::optional<penetration> * results, float epsilon=0.0001f);
 
     // Implementation details
     namespace detail
     {
         struct point { float2 p, point_on_a; };
         struct simplex { point points[3]; int count; };
-        struct polytope_edge { point v0, v1; float2 normal; float distance; };
         std::tuple<simplex,float2> next_simplex(const simplex & s, const point & new_point);
-        std::vector<polytope_edge> make_polytope(const simplex & s);
-        bool expand_polytope(std::vector<polytope_edge> & edges, point point);
-        penetration penetration_from_nearest_edge(const polytope_edge & edge);
-        template<class SupportFunction> std::optional<simplex> find_intersection_simplex(SupportFunction support_a_minus_b, float2 initial_direction, float epsilon)
+        std::tuple<simplex,point> reduce_simplex(const simplex & s); // Returns the closest point to the origin and the sub-simplex supporting it
+
+        // Polytope for EPA, held in fixed-capacity storage so that no allocation takes place. Edges form a ring through prev/next links,
+        // and a binary heap orders them by distance from the origin. Edges cut from the ring remain in the heap and are skipped when popped.
+        struct polytope
+        {
+            static constexpr int max_edges = 64, max_vertices = 3 + (max_edges-3)/2;
+            struct edge { int v0, v1, prev, next; float2 normal; float distance; bool removed; };
+            point vertices[max_vertices];
+            edge edges[max_edges];
+            int heap[max_edges];
+            int vertex_count, edge_count, heap_size, ring_size;
+
+            explicit polytope(const simplex & s);                   // Simplex must be a triangle, either winding is accepted
+            int nearest_edge();                                     // Index of the edge closest to the origin
+            bool full() const { return vertex_count == max_vertices || edge_count+2 > max_edges; } // No room to add another vertex
+            bool expand(int edge, const point & p);                 // Returns false if p is inside the polytope or capacity is exhausted
+            penetration get_penetration(int edge) const;            // Penetration data assuming the edge is the nearest to the origin
+        private:
+            int add_edge(int v0, int v1);
+        };
+        template<class SupportFunction> std::optional<simplex> find_intersection_simplex(SupportFunction support_a_minus_b, gjk_cache & cache)
         {
+            if(!(length2(cache.direction) > 0)) cache.direction = {1,0};
+            const float2 initial_direction = cache.direction;
             simplex s {{support_a_minus_b(initial_direction)},1};
+            cache.iterations = 1;
+            cache.used_epa = false;
+            COLLISION_COUNT(cache, gjk_queries);
+            COLLISION_COUNT(cache, gjk_iterations);
+            if(dot(s.points[0].p, initial_direction) < 0) return std::nullopt; // Initial direction is already a separating axis
             float2 direction = -s.points[0].p;
             while(true)
             {
                 if(!(length2(direction) > 0)) direction = -initial_direction;
                 const point p = support_a_minus_b(direction);
+                ++cache.iterations;
+                COLLISION_COUNT(cache, gjk_iterations);
+                cache.direction = direction;
                 if(dot(p.p, direction) < 0) return std::nullopt;
-                for(int i=0; i<s.count; ++i) if(p.p == s.points[i].p) return std::nullopt; // If point is already in simplex, then we've gotten as close as we can get with no intersection
+                for(int i=0; i<s.count; ++i) 
+                {
+                    if(p.p != s.points[i].p) continue;
+                    COLLISION_COUNT(cache, gjk_duplicate_exits);
+                    return std::nullopt; // If point is already in simplex, then we've gotten as close as we can get with no intersection
+                }
                 std::tie(s, direction) = next_simplex(s, p);
                 if(s.count == 3) return s;
             }
         }
-        template<class SupportFunction> std::optional<penetration> find_intersection(SupportFunction support_a_minus_b, float2 initial_direction, float epsilon)
+        template<class SupportFunction> penetration find_penetration(SupportFunction support_a_minus_b, const simplex & s, gjk_cache & cache, float epsilon)
         {
-            auto s = find_intersection_simplex(support_a_minus_b, initial_direction, epsilon);
-            if(!s) return std::nullopt;
-            auto edges = make_polytope(*s);
+            polytope poly {s};
+            cache.used_epa = true;
+            COLLISION_COUNT(cache, epa_queries);
             while(true)
             {
-                const auto it = std::min_element(begin(edges), end(edges), [](const polytope_edge & a, const polytope_edge & b) { return a.distance < b.distance; });
-                if(edges.size() == 32) return penetration_from_nearest_edge(*it);
-                const point p = support_a_minus_b(it->normal);
-                if(dot(p.p, it->normal) <= it->distance + epsilon) return penetration_from_nearest_edge(*it);
-                if(!expand_polytope(edges, p)) return penetration_from_nearest_edge(*it);
+                const int e = poly.nearest_edge();
+                const float2 normal = poly.edges[e].normal;
+                cache.direction = normal; // Separating the shapes would move the origin out through the nearest edge
+                if(poly.ring_size == 32 || poly.full()) { COLLISION_COUNT(cache, epa_edge_cap_exits); return poly.get_penetration(e); }
+                const point p = support_a_minus_b(normal);
+                if(dot(p.p, normal) <= poly.edges[e].distance + epsilon) return poly.get_penetration(e);
+                if(!poly.expand(e, p)) { COLLISION_COUNT(cache, epa_degenerate_exits); return poly.get_penetration(e); }
+                COLLISION_COUNT(cache, epa_expansions);
+            }
+        }
+        template<class SupportFunction> std::optional<penetration> find_intersection(SupportFunction support_a_minus_b, gjk_cache & cache, float epsilon)
+        {
+            auto s = find_intersection_simplex(support_a_minus_b, cache);
+            if(!s) return std::nullopt;
+            return find_penetration(support_a_minus_b, *s, cache, epsilon);
+        }
+        // Minkowski Portal Refinement. The portal is an edge of the Minkowski difference through which the ray from the interior point v0 to 
+        // the origin passes, refined by replacing one of its ends with the support point along its normal until it lies on the boundary.
+        template<class SupportFunction> std::optional<penetration> find_portal_penetration(SupportFunction support_a_minus_b, gjk_cache & cache, float epsilon)
+        {
+            if(!(length2(cache.direction) > 0)) cache.direction = {1,0};
+            const point a = support_a_minus_b(cache.direction), b = support_a_minus_b(-cache.direction);
+            point v0 {(a.p + b.p) * 0.5f, (a.point_on_a + b.point_on_a) * 0.5f};
+            if(!(length2(v0.p) > 0)) v0.p = -cache.direction * epsilon; // Origin is the interior point, so any ray leaves through the boundary
+
+            // Find the first portal, from the support point along the ray and the support point on the origin's side of the line to it
+            point v1 = support_a_minus_b(-v0.p);
+            cache.iterations = 3;
+            cache.used_epa = false;
+            if(dot(v1.p, v0.p) >= 0) { cache.direction = -v0.p; return std::nullopt; } // Origin lies beyond the support plane
+            float2 n = cross(v1.p - v0.p, 1.0f);
+            if(dot(n, v0.p) > 0) n = -n;
+            point v2 = support_a_minus_b(n);
+            ++cache.iterations;
+            if(dot(v2.p, n) < 0) { cache.direction = n; return std::nullopt; }
+
+            const auto get_penetration = [&]() -> std::optional<penetration>
+            {
+                if(!(dot(n, v1.p) >= 0)) return std::nullopt; // Origin lies beyond the portal
+                const float2 p = n * dot(v1.p, n), ab = v2.p - v1.p;
+                const float t = dot(ab, ab) > 0 ? dot(p - v1.p, ab) / dot(ab, ab) : 0;
+                return penetration{lerp(v1.point_on_a, v2.point_on_a, t), n, dot(v1.p, n)};
+            };
+            n = normalize(-v0.p);
+            for(int i=0; i<32; ++i)
+            {
+                const float2 portal_normal = cross(v2.p - v1.p, 1.0f);
+                if(!(length2(portal_normal) > 0)) break;
+                n = normalize(dot(portal_normal, v1.p - v0.p) < 0 ? -portal_normal : portal_normal);
+                const point v3 = support_a_minus_b(n);
+                ++cache.iterations;
+                cache.direction = n;
+                if(dot(v3.p, n) < 0) return std::nullopt; // Origin lies beyond the support plane
+                if(dot(v3.p - v1.p, n) <= epsilon) return get_penetration(); // Portal lies on the boundary
+
+                // Keep whichever half of the portal the ray passes through
+                if((cross(v3.p - v0.p, -v0.p) > 0) == (cross(v3.p - v0.p, v1.p - v0.p) > 0)) v2 = v3;
+                else v1 = v3;
+            }
+            return get_penetration();
+        }
+        // Closest points of the shapes. When they overlap, the triangle enclosing the origin is written to enclosing, if given.
+        template<class SupportFunction> std::optional<separation> find_separation(SupportFunction support_a_minus_b, gjk_cache & cache, float epsilon, simplex * enclosing=nullptr)
+        {
+            if(!(length2(cache.direction) > 0)) cache.direction = {1,0};
+            simplex s {{support_a_minus_b(cache.direction)},1};
+            point v = s.points[0]; // Closest point to the origin on the current simplex
+            cache.iterations = 1;
+            cache.used_epa = false;
+            COLLISION_COUNT(cache, gjk_queries);
+            COLLISION_COUNT(cache, gjk_iterations);
+            for(int i=0; i<32; ++i)
+            {
+                if(!(length2(v.p) > epsilon*epsilon)) return std::nullopt; // Shapes are touching
+                const point w = support_a_minus_b(-v.p);
+                ++cache.iterations;
+                COLLISION_COUNT(cache, gjk_iterations);
+                const float dist = length(v.p);
+                if(dist - dot(w.p, v.p)/dist <= epsilon) break; // Distance is known to within epsilon
+                bool repeated = false;
+                for(int j=0; j<s.count; ++j) repeated |= w.p == s.points[j].p;
+                if(repeated) { COLLISION_COUNT(cache, gjk_duplicate_exits); break; }
+                s.points[s.count++] = w;
+                std::tie(s, v) = reduce_simplex(s);
+                if(s.count == 3) // Simplex contains the origin, so the shapes overlap
+                {
+                    if(enclosing) *enclosing = s;
+                    return std::nullopt;
+                }
+            }
+            cache.direction = -v.p;
+            const float dist = length(v.p);
+            return separation{v.point_on_a, -v.p/dist, dist};
+        }
+        // GJK ray cast, for a shape whose support points carry the point to report as a hit in point_on_a. Runs GJK between the shape 
+        // and the point x = origin + direction*t, and whenever a support plane separates them, advances t to where x meets that plane.
+        template<class SupportFunction> std::optional<cast_hit> cast_ray(SupportFunction support, const float2 & origin, const float2 & direction, float max_t, float epsilon)
+        {
+            float t = 0;
+            float2 x = origin, n {0,0};
+            const point c = support(-direction);
+            simplex s {{{x - c.p, c.point_on_a}}, 1}; // Points of the shape relative to x
+            point v = s.points[0];
+            for(int i=0; i<32 && length2(v.p) > epsilon*epsilon; ++i)
+            {
+                const point c = support(v.p);
+                const float vw = dot(v.p, x - c.p);
+                if(vw > 0)
+                {
+                    const float vr = dot(v.p, direction);
+                    if(!(vr < 0)) return std::nullopt; // Ray points away from the support plane
+                    t -= vw / vr;
+                    if(t > max_t) return std::nullopt;
+                    const float2 dx = origin + direction*t - x;
+                    for(int j=0; j<s.count; ++j) s.points[j].p += dx;
+                    x += dx;
+                    n = v.p;
+                }
+                else 
+                {
+                    bool repeated = false;
+                    for(int j=0; j<s.count; ++j) repeated |= x - c.p == s.points[j].p;
+                    if(repeated) break; // No further progress is possible, so x is within epsilon of the shape
+                }
+                s.points[s.count++] = {x - c.p, c.point_on_a};
+                std::tie(s, v) = reduce_simplex(s);
+                if(s.count == 3) break; // Simplex contains x
+            }
+            if(s.count == 3) 
+            {
+                // The simplex encloses x, which lies within epsilon of its boundary unless the cast started inside, so take the point from the nearest edge
+                for(int j=0; j<3; ++j)
+                {
+                    const point p = std::get<1>(reduce_simplex({{s.points[j], s.points[(j+1)%3]}, 2}));
+                    if(j == 0 || length2(p.p) < length2(v.p)) v = p;
+                }
             }
+            return cast_hit{t, v.point_on_a, length2(n) > 0 ? normalize(n) : n};
         }
+
         template<class SupportFunctionA, class SupportFunctionB> auto minkowski_difference(SupportFunctionA support_a, SupportFunctionB support_b)
         {
             return [=](const float2 & d) { const float2 a = support_a(d); return detail::point{a-support_b(-d), a}; };
@@ -67,11 +374,84 @@ namespace collision
 
     template<class SupportFunctionA, class SupportFunctionB> bool check_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction)
     {
-        return detail::find_intersection_simplex(detail::minkowski_difference(support_a, support_b), initial_direction);
+        gjk_cache cache {initial_direction};
+        return detail::find_intersection_simplex(detail::minkowski_difference(support_a, support_b), cache).has_value();
+    }
+
+    struct gjk_epa { template<class SupportFunction> static std::optional<penetration> find_intersection(SupportFunction support_a_minus_b, gjk_cache & cache, float epsilon) { return detail::find_intersection(support_a_minus_b, cache, epsilon); } };
+    struct mpr { template<class SupportFunction> static std::optional<penetration> find_intersection(SupportFunction support_a_minus_b, gjk_cache & cache, float epsilon) { return detail::find_portal_penetration(support_a_minus_b, cache, epsilon); } };
+
+    template<class Engine, class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction, float epsilon) 
+    { 
+        gjk_cache cache {initial_direction};
+        return Engine::find_intersection(detail::minkowski_difference(support_a, support_b), cache, epsilon);
+    }
+
+    template<class Engine, class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, gjk_cache & cache, float epsilon) 
+    { 
+        return Engine::find_intersection(detail::minkowski_difference(support_a, support_b), cache, epsilon);
     }
 
-    template<class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_intersection(SupportFunctionA support_a, SupportFunctionB support_b, float2 initial_direction, float epsilon) 
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<separation> find_separation(SupportFunctionA support_a, SupportFunctionB support_b, gjk_cache & cache, float epsilon) 
     { 
-        return detail::find_intersection(detail::minkowski_difference(support_a, support_b), initial_direction, epsilon);
+        return detail::find_separation(detail::minkowski_difference(support_a, support_b), cache, epsilon);
+    }
+
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<penetration> find_rounded_intersection(SupportFunctionA core_a, float radius_a, SupportFunctionB core_b, float radius_b, gjk_cache & cache, float max_distance, float epsilon)
+    {
+        const auto support_a_minus_b = detail::minkowski_difference(core_a, core_b);
+        detail::simplex enclosing {{}, 0};
+        if(const auto s = detail::find_separation(support_a_minus_b, cache, epsilon, &enclosing))
+        {
+            if(s->d - radius_a - radius_b > max_distance) return std::nullopt;
+            return penetration{s->p + s->n*radius_a, s->n, radius_a + radius_b - s->d};
+        }
+        std::optional<penetration> p;
+        if(enclosing.count == 3) p = detail::find_penetration(support_a_minus_b, enclosing, cache, epsilon);
+        else
+        {
+            // Distance query stopped within epsilon of the origin, which happens when the cores touch, but also when a simplex edge passes near it
+            const int iterations = cache.iterations;
+            p = detail::find_intersection(support_a_minus_b, cache, epsilon);
+            cache.iterations += iterations;
+        }
+        if(p) return penetration{p->p + p->n*radius_a, p->n, p->d + radius_a + radius_b};
+
+        // The cores touch without overlapping, so the last search direction of GJK, which separates them, serves as the normal
+        const float2 n = normalize(cache.direction);
+        return penetration{core_a(n) + n*radius_a, n, radius_a + radius_b};
+    }
+
+    template<class SupportFunction> std::optional<cast_hit> cast_ray(SupportFunction support, const float2 & origin, const float2 & direction, float max_t, float epsilon)
+    {
+        return detail::cast_ray([=](const float2 & d) { const float2 p = support(d); return detail::point{p, p}; }, origin, direction, max_t, epsilon);
+    }
+
+    template<class SupportFunctionA, class SupportFunctionB> std::optional<cast_hit> cast_shape(SupportFunctionA support_a, const float2 & translation, SupportFunctionB support_b, float max_t, float epsilon)
+    {
+        // A translated by translation*t touches B when translation*t lies in B-A, so cast a ray from the origin against B-A, reporting points on B
+        return detail::cast_ray([=](const float2 & d) { const float2 b = support_b(d); return detail::point{b - support_a(-d), b}; }, float2{0,0}, translation, max_t, epsilon);
+    }
+
+    template<class PoseA, class PoseB> std::optional<float> find_time_of_impact(PoseA shape_a_at, const motion_bound & motion_a, PoseB shape_b_at, const motion_bound & motion_b, float target_distance, gjk_cache & cache)
+    {
+        // Over the whole interval, the shapes cannot close the gap along normal n by more than this
+        const auto get_closing_distance = [&](const float2 & n) { return dot(motion_a.displacement - motion_b.displacement, n) + motion_a.rotation_bound + motion_b.rotation_bound; };
+        float t = 0;
+        for(int i=0; i<32; ++i)
+        {
+            const auto s = find_separation(shape_a_at(t), shape_b_at(t), cache);
+            if(!s) return t;
+            if(s->d <= target_distance)
+            {
+                if(t > 0 || dot(motion_a.displacement - motion_b.displacement, s->n) > 0) return t;
+                return std::nullopt;
+            }
+            const float closing_distance = get_closing_distance(s->n);
+            if(!(closing_distance > 0)) return std::nullopt;
+            t += (s->d - target_distance/2) / closing_distance; // Cannot bring the shapes closer than target_distance/2
+            if(t > 1) return std::nullopt;
+        }
+        return std::nullopt; // Did not converge, so t may lie short of the impact or beyond it
     }
 }
\ No newline at end of file
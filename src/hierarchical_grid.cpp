@@ -0,0 +1,129 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "hierarchical_grid.h"
+#include <cmath>
+
+namespace broadphase
+{
+    static uint32_t hash_cell(int level, int x, int y) { return static_cast<uint32_t>(x)*73856093u ^ static_cast<uint32_t>(y)*19349663u ^ static_cast<uint32_t>(level)*83492791u; }
+
+    int hierarchical_grid::create_proxy(const aabb & box)
+    {
+        int proxy = static_cast<int>(boxes.size());
+        if(free_proxies.empty()) 
+        {
+            boxes.push_back(box);
+            live.push_back(true);
+            levels.push_back(0);
+        }
+        else
+        {
+            proxy = free_proxies.back();
+            free_proxies.pop_back();
+            boxes[proxy] = box;
+            live[proxy] = true;
+        }
+        return proxy;
+    }
+
+    void hierarchical_grid::destroy_proxy(int proxy)
+    {
+        live[proxy] = false;
+        free_proxies.push_back(proxy);
+    }
+
+    int hierarchical_grid::cell_coordinate(int level, float x) const { return static_cast<int>(std::floor(x / cell_sizes[level])); }
+
+    template<class F> void hierarchical_grid::for_each_cell(int level, const aabb & box, F f) const
+    {
+        const int x0 = cell_coordinate(level, box.min.x), x1 = cell_coordinate(level, box.max.x);
+        const int y0 = cell_coordinate(level, box.min.y), y1 = cell_coordinate(level, box.max.y);
+        for(int y=y0; y<=y1; ++y) for(int x=x0; x<=x1; ++x) f(x, y);
+    }
+
+    void hierarchical_grid::find_pairs(std::vector<pair> & pairs)
+    {
+        pairs.clear();
+        proxies.clear();
+        for(int i=0, n=static_cast<int>(boxes.size()); i<n; ++i) if(live[i]) proxies.push_back(i);
+        stats = {proxies.size(), 0, proxies.size() ? proxies.size()*(proxies.size()-1)/2 : 0};
+        if(proxies.empty()) return;
+
+        // Each proxy goes in the first level whose cells are large enough to hold it. The finest level is sized to fit the smallest proxy,
+        // and is never so fine that the largest proxy would not fit in the coarsest level.
+        float smallest = INFINITY, largest = 0;
+        for(int proxy : proxies) 
+        {
+            const float size = maxelem(boxes[proxy].max - boxes[proxy].min);
+            if(size > 0) smallest = std::min(smallest, size);
+            largest = std::max(largest, size);
+        }
+        cell_sizes[0] = std::isfinite(smallest) ? std::max(smallest, std::ldexp(largest, 1-max_levels)) : 1;
+        for(int level=1; level<max_levels; ++level) cell_sizes[level] = cell_sizes[level-1]*2;
+        occupied_levels = 0;
+        for(int proxy : proxies)
+        {
+            const float size = maxelem(boxes[proxy].max - boxes[proxy].min);
+            int level = 0;
+            while(level+1 < max_levels && cell_sizes[level] < size) ++level;
+            levels[proxy] = level;
+            occupied_levels |= 1u << level;
+        }
+
+        // Counting sort of (cell, proxy) entries into buckets
+        uint32_t bucket_count = 1;
+        while(bucket_count < proxies.size()*2) bucket_count *= 2;
+        const uint32_t mask = bucket_count-1;
+        bucket_start.assign(bucket_count+1, 0);
+        for(int proxy : proxies) for_each_cell(levels[proxy], boxes[proxy], [&](int x, int y) { ++bucket_start[(hash_cell(levels[proxy], x, y) & mask) + 1]; });
+        for(uint32_t b=0; b<bucket_count; ++b) bucket_start[b+1] += bucket_start[b];
+        entries.resize(bucket_start[bucket_count]);
+        for(int proxy : proxies) for_each_cell(levels[proxy], boxes[proxy], [&](int x, int y) { entries[bucket_start[hash_cell(levels[proxy], x, y) & mask]++] = {levels[proxy], x, y, proxy}; });
+        for(uint32_t b=bucket_count; b>0; --b) bucket_start[b] = bucket_start[b-1];
+        bucket_start[0] = 0;
+
+        // Emits a pair of overlapping proxies, provided the given cell contains the lower corner of the intersection of their bounds. This
+        // ensures each pair is emitted exactly once, even when the two proxies share multiple cells, or distinct cells share a bucket.
+        auto emit = [&](const entry & cell, int proxy_a, int proxy_b)
+        {
+            const aabb & a = boxes[proxy_a], & b = boxes[proxy_b];
+            if(!overlaps(a, b)) return;
+            const float2 corner = max(a.min, b.min);
+            if(cell_coordinate(cell.level, corner.x) != cell.x || cell_coordinate(cell.level, corner.y) != cell.y) return;
+            pairs.push_back({std::min(proxy_a, proxy_b), std::max(proxy_a, proxy_b)});
+        };
+
+        // Find pairs of proxies on the same level
+        for(uint32_t b=0; b<bucket_count; ++b)
+        {
+            for(uint32_t i=bucket_start[b]; i<bucket_start[b+1]; ++i)
+            {
+                const entry & ei = entries[i];
+                for(uint32_t j=i+1; j<bucket_start[b+1]; ++j)
+                {
+                    const entry & ej = entries[j];
+                    if(ei.level == ej.level && ei.x == ej.x && ei.y == ej.y && ei.proxy != ej.proxy) emit(ei, ei.proxy, ej.proxy);
+                }
+            }
+        }
+
+        // Find pairs between each proxy and the proxies in coarser levels
+        for(int proxy : proxies)
+        {
+            for(int level=levels[proxy]+1; level<max_levels; ++level)
+            {
+                if(!(occupied_levels >> level & 1)) continue;
+                for_each_cell(level, boxes[proxy], [&](int x, int y)
+                {
+                    const uint32_t b = hash_cell(level, x, y) & mask;
+                    for(uint32_t i=bucket_start[b]; i<bucket_start[b+1]; ++i)
+                    {
+                        const entry & e = entries[i];
+                        if(e.level == level && e.x == x && e.y == y) emit(e, proxy, e.proxy);
+                    }
+                });
+            }
+        }
+        stats.candidate_pairs = pairs.size();
+    }
+}
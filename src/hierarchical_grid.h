@@ -0,0 +1,41 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include "broadphase.h"
+#include <cstdint>
+
+namespace broadphase
+{
+    // Multi-level grid broadphase for worlds containing proxies of very different sizes. Level k has cells 2^k times the size of the 
+    // smallest proxy, and each proxy is placed in the finest level whose cells are at least as large as the proxy. Pairs are found within
+    // each level, and between each proxy and the cells it overlaps in all coarser levels. All levels share one flat, hashed cell array,
+    // which is rebuilt on each call to find_pairs.
+    class hierarchical_grid
+    {
+        struct entry { int level, x, y, proxy; };
+        static constexpr int max_levels = 24;
+
+        std::vector<aabb> boxes;            // Indexed by proxy ID
+        std::vector<bool> live;             // Indexed by proxy ID
+        std::vector<int> free_proxies;      // Proxy IDs available for reuse
+        std::vector<int> levels;            // Level of each proxy, indexed by proxy ID
+        std::vector<int> proxies;           // Scratch list of live proxy IDs
+        std::vector<uint32_t> bucket_start; // Index into entries of the first entry in each bucket, plus one past the end
+        std::vector<entry> entries;         // (cell, proxy) entries, sorted by bucket
+        float cell_sizes[max_levels];
+        uint32_t occupied_levels = 0;       // Bitmask of levels containing at least one proxy
+        pair_stats stats {};
+
+        template<class F> void for_each_cell(int level, const aabb & box, F f) const;
+        int cell_coordinate(int level, float x) const;
+    public:
+        int create_proxy(const aabb & box);
+        void destroy_proxy(int proxy);
+        void move_proxy(int proxy, const aabb & box) { boxes[proxy] = box; }
+        const aabb & get_bounds(int proxy) const { return boxes[proxy]; }
+
+        // Replaces the contents of pairs with all pairs of proxies whose bounds overlap
+        void find_pairs(std::vector<pair> & pairs);
+        const pair_stats & get_stats() const { return stats; }
+    };
+}
@@ -1,41 +1,18 @@
 // This is free and unencumbered software released into the public domain.
 // For more information, please refer to <http://unlicense.org/>
 #include <iostream>
-#include <variant>
+#include <cstdio>
+#include <memory>
 #include <GLFW/glfw3.h>
-#include "collision.h"
+#include "shapes.h"
 #include "physics.h"
+#include "aabb_tree.h"
+#include "bounds.h"
+#include "pair_cache.h"
+#include "static_bvh.h"
 
 void glVertex(const float2 & v) { glVertex2f(v.x, v.y); }
 
-struct circle { float2 center; float radius; };
-struct posed_box { float2 half_extent; float2 position; float orientation; };
-struct segment { float2 p0, p1; };
-struct convex_polygon { float2 points[6]; };
-
-float2 support(circle c, float2 direction) { return c.center + normalize(direction) * c.radius; }
-float2 support(posed_box b, float2 direction) 
-{ 
-    float2 local_dir = rot(-b.orientation, direction);
-    return b.position + rot(b.orientation, float2{local_dir.x > 0 ? b.half_extent.x : -b.half_extent.x, local_dir.y > 0 ? b.half_extent.y : -b.half_extent.y});
-}
-float2 support(segment l, float2 direction) { return dot(direction, l.p1-l.p0) > 0 ? l.p1 : l.p0; }
-float2 support(convex_polygon p, float2 direction) 
-{ 
-    float2 best = p.points[0];
-    float best_d = dot(p.points[0], direction);
-    for(int i=1; i<6; ++i)
-    {
-        float d = dot(p.points[i], direction);
-        if(d > best_d)
-        {
-            best = p.points[i];
-            best_d = d;
-        }
-    }
-    return best;
-}
-
 void draw(circle c)
 {
     glBegin(GL_LINE_LOOP);
@@ -49,11 +26,11 @@ void draw(circle c)
 void draw(posed_box b)
 {
     glBegin(GL_LINE_LOOP);
-    glVertex(b.position + rot(b.orientation, float2{-b.half_extent.x, -b.half_extent.y}));
-    glVertex(b.position + rot(b.orientation, float2{+b.half_extent.x, -b.half_extent.y}));
-    glVertex(b.position + rot(b.orientation, float2{+b.half_extent.x, +b.half_extent.y}));
-    glVertex(b.position + rot(b.orientation, float2{-b.half_extent.x, +b.half_extent.y}));
-    glVertex(b.position + rot(b.orientation, float2{-b.half_extent.x, -b.half_extent.y}));
+    glVertex(b.position + rotate(b.rotation, float2{-b.half_extent.x, -b.half_extent.y}));
+    glVertex(b.position + rotate(b.rotation, float2{+b.half_extent.x, -b.half_extent.y}));
+    glVertex(b.position + rotate(b.rotation, float2{+b.half_extent.x, +b.half_extent.y}));
+    glVertex(b.position + rotate(b.rotation, float2{-b.half_extent.x, +b.half_extent.y}));
+    glVertex(b.position + rotate(b.rotation, float2{-b.half_extent.x, -b.half_extent.y}));
     glEnd();
 }
 void draw(segment s)
@@ -69,19 +46,27 @@ void draw(convex_polygon p)
     for(auto & v : p.points) glVertex(v);
     glEnd();
 }
-
-template<class T> auto make_support_function(T shape) { return [shape](float2 direction) { return support(shape, direction); }; }
-
-using shape = std::variant<circle, posed_box, segment, convex_polygon>;
-
-std::optional<collision::penetration> find_intersection(const shape & shape_a, const shape & shape_b, const float2 & initial_direction)
+void draw(regular_polygon p)
+{
+    glBegin(GL_LINE_LOOP);
+    for(int i=0; i<p.sides; ++i) glVertex(get_vertex(p, i));
+    glEnd();
+}
+template<class Core> void draw(const rounded<Core> & r)
+{
+    glBegin(GL_LINE_LOOP);
+    for(int i=0, n=48; i<n; ++i) glVertex(support(r, rot(i*6.28318531f/n, float2{1,0})));
+    glEnd();
+}
+void draw(hull_polygon h)
+{
+    glBegin(GL_LINE_LOOP);
+    for(int i=0; i<h.count; ++i) glVertex(h.position + rotate(h.rotation, h.points[i]));
+    glEnd();
+}
+void draw(const compound & c)
 {
-    return std::visit([initial_direction](const auto & a, const auto & b) 
-    { 
-        auto func_a = make_support_function(a);
-        auto func_b = make_support_function(b);
-        return collision::find_intersection(func_a, func_b, {1,0}); 
-    }, shape_a, shape_b);
+    for(auto & s : c.children->shapes) std::visit([](const auto & x) { draw(x); }, transform(s, c.position, c.rotation));
 }
 
 struct entity
@@ -89,46 +74,57 @@ struct entity
     physics::rigidbody body;
     float radius;
     int type;
-
-    shape get_shape() const 
-    {
-        switch(type)
-        {
-        case 0: return circle{body.position, radius};
-        case 1: return posed_box{float2{radius}, body.position, body.orientation};
-        case 2:
-        {
-            convex_polygon p;
-            for(int i=0; i<6; ++i)
-            {
-                const float a = i*6.28318531f/6;
-                p.points[i] = body.position + rot(body.orientation, float2{std::cos(a)*radius, std::sin(a)*radius});
-            }
-            return p;
-        }
-        case 3:
-        {
-            convex_polygon p;
-            for(int i=0; i<6; ++i)
-            {
-                const float a = i*6.28318531f/3;
-                p.points[i] = body.position + rot(body.orientation, float2{std::cos(a)*radius, std::sin(a)*radius});
-            }
-            return p;
-        }
-        default: throw std::logic_error("bad type");
-        }
-    }        
+    int proxy = -1;
+    uint32_t handle = 0; // Unique for the lifetime of the program, assigned when the entity is first added to the broadphase
+    shape local_shape;   // Shape in body space, fixed for the lifetime of the entity
+    float2 rotation;     // Cos and sin of body.orientation, and the shape in world space, both refreshed once per step
+    shape world_shape;
+    std::shared_ptr<const compound_children> children; // Children of a compound local_shape
 };
 
-template<class ShapeA, class ShapeB> std::optional<collision::penetration> find_intersection(const ShapeA & shape_a, const ShapeB & shape_b)
+entity make_entity(const physics::rigidbody & body, float radius, int type)
 {
-    return collision::find_intersection(make_support_function(shape_a), make_support_function(shape_b));
+    // World space fields start as for an unrotated body, until the first step refreshes them
+    const auto make = [&](const shape & s) { return entity{body, radius, type, -1, 0, s, {1,0}, s, nullptr}; };
+    switch(type)
+    {
+    case 0: return make(circle{{0,0}, radius});
+    case 1: return make(posed_box{float2{radius}, {0,0}, {1,0}});
+    case 2: return make(regular_polygon{{0,0}, {radius,0}, 6});
+    case 3: return make(regular_polygon{{0,0}, {radius,0}, 3});
+    case 4: return make(capsule{{{-radius*0.6f,0}, {radius*0.6f,0}}, radius*0.4f});
+    case 5: return make(rounded_box{{float2{radius*0.8f}, {0,0}, {1,0}}, radius*0.2f});
+    case 6: return make(rounded_polygon{{{0,0}, {radius*0.8f,0}, 3}, radius*0.2f});
+    case 7: 
+    {
+        // A cart, built from a chassis, a cabin and two wheels in a single body
+        auto children = std::make_shared<const compound_children>(std::vector<shape>{
+            posed_box{{radius, radius*0.2f}, {0,0}, {1,0}}, 
+            posed_box{{radius*0.4f, radius*0.3f}, {-radius*0.3f, radius*0.5f}, {1,0}}, 
+            circle{{-radius*0.65f, -radius*0.3f}, radius*0.3f}, 
+            circle{{radius*0.65f, -radius*0.3f}, radius*0.3f}});
+        entity e = make(compound{children.get(), {0,0}, {1,0}});
+        e.children = move(children);
+        return e;
+    }
+    default: throw std::logic_error("bad type");
+    }
 }
 
+// Narrowphase results for a pair of entities, cached between frames
+struct contact_state
+{
+    float2 position_a, position_b;      // Poses of both bodies when the narrowphase last ran
+    float orientation_a, orientation_b;
+    float2 gjk_direction;               // Last GJK search direction, in the local space of body A
+    collision::manifold manifold;
+    int first_child_manifold, child_manifold_count; // In place of manifold for pairs involving a compound, a range of world::child_manifolds
+};
+
 #include <vector>
 #include <chrono>
 #include <random>
+#include <fstream>
 int main() try
 {
     const segment segs[] 
@@ -136,14 +132,67 @@ int main() try
         {{0.1f,-0.3f},{0.7f,0.3f}},
         {{-1.5f,0},{0,-1.0f}},
     };
+    std::vector<broadphase::aabb> seg_bounds;
+    for(auto & seg : segs) seg_bounds.push_back(broadphase::compute_bounds(seg));
+    const broadphase::static_bvh world_bvh {seg_bounds};
+    const chain terrain {{{-0.3f,-0.8f}, {0,-0.92f}, {0.25f,-0.9f}, {0.5f,-0.8f}, {0.8f,-0.7f}}, false}; // A shallow valley beneath the segments
+    const auto ground = quantize(generate_terrain(1, {0.8f,-0.7f}, 97, 0.01f, 0.08f, 32)); // Rough ground to the right of the valley
+    const float speculative_distance = 0.05f; // Shapes closer than this generate contacts before they touch
 
     struct world
     {
         std::mt19937 rng;
         std::vector<entity> entities;
+        broadphase::obb_array obbs;
+        broadphase::bounds_array bounds;
+        broadphase::aabb_tree broadphase;
+        std::vector<entity *> proxy_entities;
+        std::vector<broadphase::pair> pairs;
+        broadphase::pair_cache<contact_state> contacts;
+        std::vector<child_manifold> child_manifolds, last_child_manifolds; // Manifolds of compound pairs this frame and last, so that cached ranges stay valid while this frame's are written
+        uint32_t next_handle = 1;
+        size_t gjk_queries = 0, gjk_iterations = 0;
+        size_t contacts_found = 0, contacts_using_epa = 0; // Narrowphase queries which produced contacts, and how many of those needed EPA
     };
     world w;
 
+    // Scene queries, which walk the world segments nearest first and test the terrain and ground edges within the swept bounds, then walk
+    // the body proxies nearest first, clipping to the nearest hit found so far
+    struct ray { float2 origin, direction; float max_t; };
+    struct scene_hit { collision::cast_hit hit; const entity * body; }; // Body is null for hits on the world segments, terrain or ground
+    const auto cast = [&](const broadphase::aabb & box, const float2 & direction, float max_t, auto cast_against) 
+    {
+        std::optional<scene_hit> nearest;
+        const auto clip = [&](const std::optional<collision::cast_hit> & hit, const entity * body, float max_t) 
+        { 
+            if(!hit || !(hit->t < max_t)) return max_t;
+            nearest = scene_hit{*hit, body};
+            return hit->t; 
+        };
+        const broadphase::aabb swept_box {min(box.min, box.min + direction*max_t), max(box.max, box.max + direction*max_t)};
+        world_bvh.boxcast(box, direction, max_t, [&](int index, float max_t) { return clip(cast_against(shape{segs[index]}, max_t), nullptr, max_t); });
+        if(nearest) max_t = nearest->hit.t;
+        terrain.query(swept_box, [&](int index) { max_t = clip(cast_against(shape{terrain.get_edge(index)}, max_t), nullptr, max_t); return true; });
+        const auto [first, last] = ground.find_edges(swept_box.min.x, swept_box.max.x);
+        for(int i=first; i<last; ++i) max_t = clip(cast_against(shape{ground.get_edge(i)}, max_t), nullptr, max_t);
+        w.broadphase.boxcast(box, direction, nearest ? nearest->hit.t : max_t, [&](int proxy, float max_t) 
+        { 
+            const entity * e = w.proxy_entities[proxy];
+            return clip(cast_against(e->world_shape, max_t), e, max_t); 
+        });
+        return nearest;
+    };
+    const auto raycast = [&](const ray & r)
+    {
+        return cast({r.origin, r.origin}, r.direction, r.max_t, [&](const shape & s, float max_t) { return cast_ray(s, r.origin, r.direction, max_t); });
+    };
+    const auto shapecast = [&](const shape & s, const float2 & translation, float max_t)
+    {
+        const auto box = std::visit([](const auto & s) { return broadphase::compute_bounds(s); }, s);
+        return cast(box, translation, max_t, [&](const shape & target, float max_t) { return cast_shape(s, translation, target, max_t); });
+    };
+    const auto raycast_batch = [&](const ray * rays, size_t count, std::optional<scene_hit> * hits) { for(size_t i=0; i<count; ++i) hits[i] = raycast(rays[i]); };
+
     glfwInit();
     auto win = glfwCreateWindow(1280, 720, "Simulation", nullptr, nullptr);
     glfwSetWindowUserPointer(win, &w);
@@ -156,15 +205,25 @@ int main() try
             float radius = std::max(radius_dist(w.rng), 0.05f);
             switch(key)
             {
-            case GLFW_KEY_1: w.entities.push_back({{{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius), 0.4f}, radius, 0}); break;
-            case GLFW_KEY_2: w.entities.push_back({{{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_box(1.0f, float2{radius*2}), 0.4f}, radius, 1}); break;
-            case GLFW_KEY_3: w.entities.push_back({{{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius*0.9f), 0.4f}, radius, 2}); break;
-            case GLFW_KEY_4: w.entities.push_back({{{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius*0.9f), 0.4f}, radius, 3}); break;
+            case GLFW_KEY_1: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius), 0.4f}, radius, 0)); break;
+            case GLFW_KEY_2: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_box(1.0f, float2{radius*2}), 0.4f}, radius, 1)); break;
+            case GLFW_KEY_3: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius*0.9f), 0.4f}, radius, 2)); break;
+            case GLFW_KEY_4: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius*0.9f), 0.4f}, radius, 3)); break;
+            case GLFW_KEY_5: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_box(1.0f, float2{radius*2, radius*0.8f}), 0.4f}, radius, 4)); break;
+            case GLFW_KEY_6: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_box(1.0f, float2{radius*2}), 0.4f}, radius, 5)); break;
+            case GLFW_KEY_7: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_circle(1.0f, radius*0.9f), 0.4f}, radius, 6)); break;
+            case GLFW_KEY_8: w.entities.push_back(make_entity({{0.0f,1}, {0,0}, 0.0f, 0.0f, physics::compute_mass_for_box(1.0f, float2{radius*2, radius}), 0.4f}, radius, 7)); break;
             }            
         }
     });
 
     glfwMakeContextCurrent(win);
+#ifdef COLLISION_STATS
+    // Record the narrowphase counters of every frame, by pair of shape types
+    std::ofstream stats_csv("narrowphase_stats.csv");
+    shape_pair_stats::write_csv_header(stats_csv);
+    size_t frame = 0;
+#endif
     using clock = std::chrono::high_resolution_clock;
     auto t0 = clock::now();
     while(!glfwWindowShouldClose(win))
@@ -175,69 +234,264 @@ int main() try
         const auto timestep = std::chrono::duration<float>(t1-t0).count();
         t0 = t1;
 
-        // Add gravity and integrate
+        // Add gravity and integrate. Bodies which move more than half their radius in one step could pass through the world segments, the 
+        // terrain, the ground or each other, so they advance in up to four sub-steps, each ending at the first time of impact along the rest of the step. At
+        // each impact, the velocity into the obstacle is resolved as a single contact, and the body spends the remaining time on its new
+        // velocity. Obstacles the body already starts near were within the speculative distance when contacts were last found, so the solved 
+        // velocity already respects them, and they are skipped rather than stopping the body for the whole step. Other bodies are swept 
+        // along their own motion over the same interval, from the poses they began the step in.
         float2 accel {0,-1};
-        for(auto & e : w.entities)
+        const auto get_sweep = [&](const physics::rigidbody & body, float duration) { return sweep{body.position, body.velocity()*duration + accel*(duration*duration/2), body.orientation, body.spin()*duration}; };
+        const auto get_pose = [](const sweep & s, float t) { const float orientation = s.orientation + s.rotation*t; return std::make_pair(s.position + s.displacement*t, float2{std::cos(orientation), std::sin(orientation)}); };
+        std::vector<sweep> sweeps;
+        for(auto & e : w.entities) 
         {
-            e.body.position += e.body.velocity()*timestep + accel*(timestep*timestep/2);
-            e.body.orientation += e.body.spin()*timestep;
+            sweeps.push_back(get_sweep(e.body, timestep));
+            if(e.proxy >= 0) w.proxy_entities[e.proxy] = &e; // Entities may have been reallocated by the key callback
+        }
+        for(size_t i=0; i<w.entities.size(); ++i)
+        {
+            auto & e = w.entities[i];
+            sweep s = sweeps[i];
+            float elapsed = 0; // Fraction of the step taken so far
+            for(int substep=0; substep<4; ++substep)
+            {
+                struct impact { float t; shape target; sweep target_sweep; entity * body; }; // Target is in world space for static geometry, and in body space for bodies
+                std::optional<impact> first;
+                if(length(s.displacement) > e.radius/2)
+                {
+                    const float radius = get_bounding_radius(e.local_shape);
+                    const broadphase::aabb swept_bounds {min(s.position, s.position + s.displacement) - radius, max(s.position, s.position + s.displacement) + radius};
+                    const auto sweep_against = [&](const shape & target, const sweep & target_sweep, entity * body, const float2 & target_point)
+                    {
+                        collision::gjk_cache cache {target_point - s.position};
+                        const auto toi = find_time_of_impact(e.local_shape, s, target, target_sweep, speculative_distance/2, cache);
+                        if(toi && *toi > 0 && (!first || *toi < first->t)) first = impact{*toi, target, target_sweep, body};
+                    };
+                    world_bvh.query(swept_bounds, [&](int index) { sweep_against(segs[index], sweep{}, nullptr, segs[index].p0); return true; });
+                    terrain.query(swept_bounds, [&](int index) { const auto edge = terrain.get_edge(index); sweep_against(edge, sweep{}, nullptr, edge.p0); return true; });
+                    const auto [first_edge, last_edge] = ground.find_edges(swept_bounds.min.x, swept_bounds.max.x);
+                    for(int j=first_edge; j<last_edge; ++j) { const auto edge = ground.get_edge(j); sweep_against(edge, sweep{}, nullptr, edge.p0); }
+                    w.broadphase.query(swept_bounds, [&](int proxy) 
+                    { 
+                        entity * other = w.proxy_entities[proxy];
+                        if(other == &e) return true;
+                        const sweep & o = sweeps[other - w.entities.data()];
+                        sweep_against(other->local_shape, {o.position + o.displacement*elapsed, o.displacement*(1-elapsed), o.orientation + o.rotation*elapsed, o.rotation*(1-elapsed)}, other, o.position);
+                        return true; 
+                    });
+                }
+                const float t = first ? first->t : 1;
+                e.body.position += s.displacement*t;
+                e.body.orientation += s.rotation*t;
+                if(!first) break;
+
+                // Resolve the impact as a contact between the poses at that time, then sweep the rest of the step from there
+                const auto [position_b, rotation_b] = get_pose(first->target_sweep, t);
+                const shape shape_a = transform(e.local_shape, e.body.position, float2{std::cos(e.body.orientation), std::sin(e.body.orientation)});
+                const shape shape_b = first->body ? transform(first->target, position_b, rotation_b) : first->target;
+                collision::gjk_cache cache {position_b - e.body.position};
+                if(const auto contact = find_contact(shape_a, shape_b, cache, speculative_distance))
+                {
+                    physics::rigidbody * body_b = first->body ? &first->body->body : nullptr;
+                    const float2 n = contact->normal_a_to_b(), velocity_b = body_b ? body_b->velocity() : float2{0,0};
+                    const float elasticity = body_b ? std::min(e.body.elasticity, body_b->elasticity) : e.body.elasticity;
+                    physics::solve_constraints({{&e.body, body_b, contact->point_on_a() - e.body.position, body_b ? contact->point_on_b() - position_b : contact->point_on_b(), 
+                                                 n, dot(velocity_b - e.body.velocity(), n) * -elasticity, 0, 1000}});
+                }
+                elapsed += t*(1-elapsed);
+                s = get_sweep(e.body, timestep*(1-elapsed));
+            }
             e.body.momentum += accel*(e.body.mass_dist.mass*timestep);
         }
 
         // Remove rigidbodies that have fallen off the screen
+        for(auto & e : w.entities) if(e.body.position.y < -3 && e.proxy >= 0) w.broadphase.destroy_proxy(e.proxy);
         auto it = std::remove_if(begin(w.entities), end(w.entities), [](const entity & e) { return e.body.position.y < -3; });
         w.entities.erase(it, end(w.entities));
 
+        // Place every shape in world space once, so that the narrowphase never needs to evaluate sin and cos per pair
+        for(auto & e : w.entities)
+        {
+            e.rotation = {std::cos(e.body.orientation), std::sin(e.body.orientation)};
+            e.world_shape = transform(e.local_shape, e.body.position, e.rotation);
+        }
+
         // Collision detection
         std::vector<physics::linear_constraint> constraints;
+        std::vector<child_manifold> child_manifolds;
+
+        // Speculative contacts allow the bodies to approach by no more than the gap between them over this timestep. Contacts with the 
+        // world have no second body, and their points on the world are in world space.
+        const auto add_constraints = [&](entity & a, entity * b, const collision::manifold & manifold)
+        {
+            const float2 velocity_b = b ? b->body.velocity() : float2{0,0};
+            const float elasticity = b ? std::min(a.body.elasticity, b->body.elasticity) : a.body.elasticity;
+            for(int i=0; i<manifold.count; ++i)
+            {
+                const auto & pen = manifold.points[i];
+                float v = dot(velocity_b - a.body.velocity(), pen.normal_a_to_b());
+                float dvel = pen.penetration_depth() < 0 ? pen.penetration_depth() / timestep : std::max(v * -elasticity, pen.penetration_depth() / 0.1f);
+                constraints.push_back({&a.body, b ? &b->body : nullptr, pen.point_on_a()-a.body.position, b ? pen.point_on_b()-b->body.position : pen.point_on_b(), pen.normal_a_to_b(), dvel, 0, 1000});
+            }
+        };
+
+        // Compute bounds of every entity. Circles and boxes are handled in bulk, other shapes are bounded using their support function.
+        w.obbs.clear();
+        for(auto & e : w.entities)
+        {
+            switch(e.type)
+            {
+            case 0: w.obbs.push_back(e.body.position, 1, 0, float2{e.radius}); break;
+            case 1: w.obbs.push_back(e.body.position, e.rotation.x, e.rotation.y, float2{e.radius}); break;
+            default: w.obbs.push_back(std::visit([](const auto & s) { return broadphase::compute_bounds(s); }, e.world_shape)); break;
+            }
+        }
+        broadphase::compute_bounds(w.obbs, w.bounds);
+
+        // Update broadphase proxies, with bounds grown so that pairs within the speculative distance are reported
+        for(size_t i=0; i<w.entities.size(); ++i)
+        {
+            auto & e = w.entities[i];
+            const auto bounds = broadphase::expand(w.bounds.get(i), speculative_distance/2);
+            if(e.proxy < 0)
+            {
+                e.proxy = w.broadphase.create_proxy(bounds);
+                e.handle = w.next_handle++;
+            }
+            else w.broadphase.move_proxy(e.proxy, bounds);
+            if(w.proxy_entities.size() <= static_cast<size_t>(e.proxy)) w.proxy_entities.resize(e.proxy+1);
+            w.proxy_entities[e.proxy] = &e;
+        }
+        w.broadphase.find_pairs(w.pairs);
 
         // Collide with each other
-        for(auto & a : w.entities)
+        w.gjk_queries = w.gjk_iterations = w.contacts_found = w.contacts_using_epa = 0;
+        w.contacts.begin_frame();
+        std::swap(w.child_manifolds, w.last_child_manifolds);
+        w.child_manifolds.clear();
+        for(auto & pair : w.pairs)
         {
-            for(auto & b : w.entities)
+            entity * a = w.proxy_entities[pair.a], * b = w.proxy_entities[pair.b];
+            if(b->handle < a->handle) std::swap(a, b);
+
+            // Only run the narrowphase for pairs which are new, or where either body has moved since the last frame
+            auto [state, status] = w.contacts.touch(a->handle, b->handle);
+            const bool moved = status == broadphase::pair_status::begin || state.position_a != a->body.position || state.position_b != b->body.position 
+                || state.orientation_a != a->body.orientation || state.orientation_b != b->body.orientation;
+
+            // Compounds have a manifold for each pair of children in contact, which are found afresh or carried over from last frame
+            if(a->children || b->children)
             {
-                if(&b <= &a) continue;
-                if(auto pen = find_intersection(a.get_shape(), b.get_shape(), b.body.position - a.body.position))
+                const int first = static_cast<int>(w.child_manifolds.size());
+                if(moved)
+                {
+                    state.position_a = a->body.position; state.position_b = b->body.position;
+                    state.orientation_a = a->body.orientation; state.orientation_b = b->body.orientation;
+                    find_child_manifolds(a->world_shape, b->world_shape, speculative_distance, w.child_manifolds);
+                    w.contacts_found += w.child_manifolds.size() - first;
+                    for(size_t i=first; i<w.child_manifolds.size(); ++i) if(w.child_manifolds[i].used_epa) ++w.contacts_using_epa;
+                }
+                else
                 {
-                    float v = dot(b.body.velocity() - a.body.velocity(), pen->normal_a_to_b());
-                    float dvel = std::max(v * -std::min(a.body.elasticity, b.body.elasticity), pen->penetration_depth() / 0.1f);
-                    constraints.push_back({&a.body, &b.body, pen->point_on_a()-a.body.position, pen->point_on_b()-b.body.position, pen->normal_a_to_b(), dvel, 0, 1000});
+                    const auto last = w.last_child_manifolds.begin() + state.first_child_manifold;
+                    w.child_manifolds.insert(w.child_manifolds.end(), last, last + state.child_manifold_count);
                 }
+                state.first_child_manifold = first;
+                state.child_manifold_count = static_cast<int>(w.child_manifolds.size()) - first;
+                for(size_t i=first; i<w.child_manifolds.size(); ++i) add_constraints(*a, b, w.child_manifolds[i].manifold);
+                continue;
             }
+
+            if(moved)
+            {
+                // Warm start GJK from the direction it last terminated on, which is stored relative to body A so that it follows rotation
+                collision::gjk_cache cache {status == broadphase::pair_status::begin ? b->body.position - a->body.position : rotate(a->rotation, state.gjk_direction)};
+                auto manifold = find_manifold(a->world_shape, b->world_shape, cache, speculative_distance);
+                state = {a->body.position, b->body.position, a->body.orientation, b->body.orientation, rotate(a->rotation * float2{1,-1}, cache.direction), manifold, 0, 0};
+                if(cache.iterations) ++w.gjk_queries;
+                w.gjk_iterations += cache.iterations;
+                if(manifold.count) ++w.contacts_found;
+                if(manifold.count && cache.used_epa) ++w.contacts_using_epa;
+            }
+
+            add_constraints(*a, b, state.manifold);
         }
+        w.contacts.end_frame();
 
-        // Collide with world
-        for(auto & e : w.entities)
+        // Collide with world, through only the segments, terrain and ground edges near each entity
+        for(size_t i=0; i<w.entities.size(); ++i)
         {
-            for(auto seg : segs)
+            auto & e = w.entities[i];
+            child_manifolds.clear();
+            world_bvh.query(broadphase::expand(w.bounds.get(i), speculative_distance), [&](int index)
             {
-                if(auto pen = find_intersection(e.get_shape(), seg, seg.p0 - e.body.position))
-                {
-                    float v = dot(-e.body.velocity(), pen->normal_a_to_b());
-                    float dvel = std::max(v * -e.body.elasticity, pen->penetration_depth() / 0.1f);
-                    constraints.push_back({&e.body, nullptr, pen->point_on_a()-e.body.position, pen->point_on_b(), pen->normal_a_to_b(), dvel, 0, 1000});
-                }
+                find_child_manifolds(e.world_shape, shape{segs[index]}, speculative_distance, child_manifolds);
+                return true;
+            });
+            find_chain_manifolds(e.world_shape, terrain, speculative_distance, child_manifolds);
+            find_heightfield_manifolds(e.world_shape, ground, speculative_distance, child_manifolds);
+            w.contacts_found += child_manifolds.size();
+            for(auto & m : child_manifolds) 
+            {
+                if(m.used_epa) ++w.contacts_using_epa;
+                add_constraints(e, nullptr, m.manifold);
             }
         }
 
+#ifdef COLLISION_STATS
+        get_narrowphase_stats().write_csv(stats_csv, frame++);
+        get_narrowphase_stats() = {};
+#endif
+
         // Run solver
         solve_constraints(constraints);
 
         // Set up matrices
+        float aspect;
         {
             int w, h;
             glfwGetFramebufferSize(win, &w, &h);
-            float aspect = (float)w/h;
+            aspect = (float)w/h;
             auto m = linalg::frustum_matrix(-aspect, aspect, -1.0f, 1.0f, 1.0f, 2.0f, linalg::neg_z, linalg::neg_one_to_one);
             glLoadMatrixf(m.data());
             glTranslatef(0,0,-1);
         }
 
+        // Cast a fan of sensor rays from the cursor, and a small box straight down from it
+        double cursor_x, cursor_y;
+        int window_width, window_height;
+        glfwGetCursorPos(win, &cursor_x, &cursor_y);
+        glfwGetWindowSize(win, &window_width, &window_height);
+        const float2 cursor {(float(cursor_x/window_width)*2-1)*aspect, 1-float(cursor_y/window_height)*2};
+        ray sensors[32];
+        std::optional<scene_hit> sensor_hits[32];
+        for(int i=0; i<32; ++i) sensors[i] = {cursor, rot(i*6.28318531f/32, float2{1,0}), 0.5f};
+        raycast_batch(sensors, 32, sensor_hits);
+        const posed_box probe {{0.05f,0.05f}, cursor, {1,0}};
+        const auto probe_hit = shapecast(probe, {0,-1}, 2.0f);
+
         // Render scene
         glClear(GL_COLOR_BUFFER_BIT);
-        for(const auto & e : w.entities) std::visit([](const auto & s) { draw(s); }, e.get_shape());
-        for(const auto & seg : segs) draw(seg);        
+        const broadphase::aabb view {{-aspect-0.1f, -1.1f}, {aspect+0.1f, 1.1f}}; // Bodies may have moved slightly since their bounds were computed
+        for(size_t i=0; i<w.entities.size(); ++i) if(overlaps(w.bounds.get(i), view)) std::visit([](const auto & s) { draw(s); }, w.entities[i].world_shape);
+        for(const auto & seg : segs) draw(seg);
+        for(int i=0; i<terrain.get_edge_count(); ++i) draw(terrain.get_edge(i));
+        for(int i=0; i<ground.get_edge_count(); ++i) draw(ground.get_edge(i));        
+        glColor3f(0.5f,0.5f,0.5f);
+        for(int i=0; i<32; ++i) draw(segment{cursor, cursor + sensors[i].direction*(sensor_hits[i] ? sensor_hits[i]->hit.t : sensors[i].max_t)});
+        if(probe_hit) draw(posed_box{probe.half_extent, probe.position + float2{0,-probe_hit->hit.t}, probe.rotation});
+        glColor3f(1,1,1);
         glfwSwapBuffers(win);        
+
+        // Report broadphase pruning and contact lifetimes in the title bar
+        const auto & stats = w.broadphase.get_stats();
+        const auto & contact_stats = w.contacts.get_stats();
+        char title[320];
+        snprintf(title, sizeof(title), "Simulation - %zu bodies, %zu/%zu candidate pairs (%.1f%% pruned), %zu began, %zu persisted, %zu ended, %zu GJK queries (%.2f iterations avg), %.1f%% of contacts used EPA", 
+            stats.proxies, stats.candidate_pairs, stats.total_pairs, stats.pruning_ratio()*100, contact_stats.began, contact_stats.persisted, contact_stats.ended,
+            w.gjk_queries, w.gjk_queries ? double(w.gjk_iterations)/w.gjk_queries : 0.0, w.contacts_found ? 100.0*w.contacts_using_epa/w.contacts_found : 0.0);
+        glfwSetWindowTitle(win, title);
     }
     glfwTerminate();
     return EXIT_SUCCESS;
@@ -0,0 +1,106 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace broadphase
+{
+    enum class pair_status { begin, persist };
+    struct pair_cache_stats { size_t began, persisted, ended; };
+
+    // Persistent table of pairs keyed by a pair of stable handles, storing per-pair state of type State across frames. Implemented as an 
+    // open addressing hash table with linear probing in a single flat array, so no allocations occur once the table has reached its working size.
+    // 
+    // Each frame, call begin_frame(), then touch() every pair which is currently in contact, then end_frame() to remove pairs which were not touched.
+    template<class State> class pair_cache
+    {
+        static constexpr uint64_t empty_key = ~uint64_t(0);
+        struct slot { uint64_t key; uint32_t frame; State state; };
+        std::vector<slot> slots;            // Size is always zero or a power of two
+        std::vector<uint64_t> ended;        // Scratch list of keys to remove at the end of a frame
+        size_t count = 0;
+        uint32_t frame = 0;
+        pair_cache_stats stats {};
+
+        static uint64_t make_key(uint32_t a, uint32_t b) { return a < b ? uint64_t(a) << 32 | b : uint64_t(b) << 32 | a; }
+        size_t home(uint64_t key) const { return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (slots.size()-1); }
+        void grow();
+        void erase_slot(size_t i);
+    public:
+        size_t size() const { return count; }
+        const pair_cache_stats & get_stats() const { return stats; }
+
+        void begin_frame() { ++frame; stats = {}; }
+
+        // Marks the pair as being in contact this frame, and returns its state, along with whether this is the first frame of contact.
+        // State is value-initialized when a pair begins.
+        std::pair<State &, pair_status> touch(uint32_t a, uint32_t b);
+
+        // Removes every pair which was not touched since begin_frame(), counting them as ended
+        void end_frame()
+        {
+            ended.clear();
+            for(auto & s : slots) if(s.key != empty_key && s.frame != frame) ended.push_back(s.key);
+
+            // Removing an entry may shift later entries of the same cluster backwards, so each key is looked up again before removal
+            for(const uint64_t key : ended)
+            {
+                size_t i = home(key);
+                while(slots[i].key != key) i = (i+1) & (slots.size()-1);
+                erase_slot(i);
+            }
+            stats.ended = ended.size();
+        }
+    };
+
+    template<class State> std::pair<State &, pair_status> pair_cache<State>::touch(uint32_t a, uint32_t b)
+    {
+        if(2*(count+1) > slots.size()) grow();
+        const uint64_t key = make_key(a, b);
+        size_t i = home(key);
+        for(; slots[i].key != empty_key; i = (i+1) & (slots.size()-1))
+        {
+            if(slots[i].key != key) continue;
+            slots[i].frame = frame;
+            ++stats.persisted;
+            return {slots[i].state, pair_status::persist};
+        }
+        slots[i] = {key, frame, State{}};
+        ++count;
+        ++stats.began;
+        return {slots[i].state, pair_status::begin};
+    }
+
+    template<class State> void pair_cache<State>::grow()
+    {
+        std::vector<slot> old(std::max<size_t>(slots.size()*2, 64), slot{empty_key, 0, State{}});
+        std::swap(old, slots);
+        for(auto & s : old)
+        {
+            if(s.key == empty_key) continue;
+            size_t i = home(s.key);
+            while(slots[i].key != empty_key) i = (i+1) & (slots.size()-1);
+            slots[i] = std::move(s);
+        }
+    }
+
+    // Backward shift deletion: Move later entries of the same cluster into the hole, so that lookups never need tombstones
+    template<class State> void pair_cache<State>::erase_slot(size_t hole)
+    {
+        const size_t mask = slots.size()-1;
+        for(size_t i = (hole+1) & mask; slots[i].key != empty_key; i = (i+1) & mask)
+        {
+            // An entry may move into the hole only if the hole lies cyclically within [home, i)
+            const size_t h = home(slots[i].key);
+            if(((i - h) & mask) >= ((i - hole) & mask))
+            {
+                slots[hole] = std::move(slots[i]);
+                hole = i;
+            }
+        }
+        slots[hole].key = empty_key;
+        --count;
+    }
+}
@@ -0,0 +1,549 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "shapes.h"
+#include "bounds.h"
+#include <array>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+#include <random>
+#include <limits>
+
+static const char * const shape_names[] {"circle", "posed_box", "segment", "convex_polygon", "regular_polygon", "hull_polygon", "capsule", "rounded_box", "rounded_polygon", "compound"};
+static_assert(std::size(shape_names) == std::variant_size_v<shape>, "every shape type needs a name");
+static shape_pair_stats pair_stats;
+shape_pair_stats & get_narrowphase_stats() { return pair_stats; }
+
+void shape_pair_stats::write_csv_header(std::ostream & out)
+{
+    out << "frame,shape_a,shape_b,gjk_queries,gjk_iterations,gjk_duplicate_exits,epa_queries,epa_expansions,epa_edge_cap_exits,epa_degenerate_exits\n";
+}
+void shape_pair_stats::write_csv(std::ostream & out, size_t frame) const
+{
+    for(size_t i=0; i<std::variant_size_v<shape>; ++i)
+    {
+        for(size_t j=0; j<std::variant_size_v<shape>; ++j)
+        {
+            const auto & s = pairs[i][j];
+            if(!s.gjk_queries && !s.epa_queries) continue;
+            out << frame << ',' << shape_names[i] << ',' << shape_names[j] << ',' << s.gjk_queries << ',' << s.gjk_iterations << ',' << s.gjk_duplicate_exits << ',' 
+                << s.epa_queries << ',' << s.epa_expansions << ',' << s.epa_edge_cap_exits << ',' << s.epa_degenerate_exits << '\n';
+        }
+    }
+}
+
+// Moves the counters accumulated in a cache to the entry for a pair of shapes
+#ifdef COLLISION_STATS
+static void record_stats(const shape & a, const shape & b, collision::gjk_cache & cache)
+{
+    pair_stats.pairs[a.index()][b.index()] += cache.stats;
+    cache.stats = {};
+}
+#else
+static void record_stats(const shape &, const shape &, collision::gjk_cache &) {}
+#endif
+
+struct box_vertices { float2 points[4]; };
+static box_vertices get_vertices(const posed_box & b)
+{
+    return {{b.position + rotate(b.rotation, float2{-b.half_extent.x, -b.half_extent.y}),
+             b.position + rotate(b.rotation, float2{+b.half_extent.x, -b.half_extent.y}),
+             b.position + rotate(b.rotation, float2{+b.half_extent.x, +b.half_extent.y}),
+             b.position + rotate(b.rotation, float2{-b.half_extent.x, +b.half_extent.y})}};
+}
+
+static circle transform(const circle & c, const float2 & position, const float2 & rotation) { return {position + rotate(rotation, c.center), c.radius}; }
+static posed_box transform(const posed_box & b, const float2 & position, const float2 & rotation) { return {b.half_extent, position + rotate(rotation, b.position), rotate(rotation, b.rotation)}; }
+static segment transform(const segment & s, const float2 & position, const float2 & rotation) { return {position + rotate(rotation, s.p0), position + rotate(rotation, s.p1)}; }
+static convex_polygon transform(const convex_polygon & p, const float2 & position, const float2 & rotation)
+{
+    convex_polygon r;
+    for(int i=0; i<6; ++i) r.points[i] = position + rotate(rotation, p.points[i]);
+    return r;
+}
+static regular_polygon transform(const regular_polygon & p, const float2 & position, const float2 & rotation) { return {position + rotate(rotation, p.center), rotate(rotation, p.corner), p.sides}; }
+static hull_polygon transform(const hull_polygon & h, const float2 & position, const float2 & rotation) { return {h.points, h.count, position + rotate(rotation, h.position), rotate(rotation, h.rotation)}; }
+template<class Core> static rounded<Core> transform(const rounded<Core> & r, const float2 & position, const float2 & rotation) { return {transform(r.core, position, rotation), r.radius}; }
+static compound transform(const compound & c, const float2 & position, const float2 & rotation) { return {c.children, position + rotate(rotation, c.position), rotate(rotation, c.rotation)}; }
+shape transform(const shape & local_shape, const float2 & position, const float2 & rotation) { return std::visit([&](const auto & s) { return shape{transform(s, position, rotation)}; }, local_shape); }
+
+static float get_bounding_radius(const circle & c) { return length(c.center) + c.radius; }
+static float get_bounding_radius(const posed_box & b) { return length(b.position) + length(b.half_extent); }
+static float get_bounding_radius(const segment & s) { return std::max(length(s.p0), length(s.p1)); }
+static float get_bounding_radius(const convex_polygon & p) { float r = 0; for(auto & v : p.points) r = std::max(r, length(v)); return r; }
+static float get_bounding_radius(const regular_polygon & p) { return length(p.center) + length(p.corner); }
+static float get_bounding_radius(const hull_polygon & h) { float r = 0; for(int i=0; i<h.count; ++i) r = std::max(r, length(h.points[i])); return length(h.position) + r; }
+template<class Core> static float get_bounding_radius(const rounded<Core> & r) { return get_bounding_radius(r.core) + r.radius; }
+static float get_bounding_radius(const compound & c) { float r = 0; for(auto & s : c.children->shapes) r = std::max(r, get_bounding_radius(s)); return length(c.position) + r; }
+float get_bounding_radius(const shape & local_shape) { return std::visit([](const auto & s) { return get_bounding_radius(s); }, local_shape); }
+
+static broadphase::aabb compute_bounds(const shape & s) { return std::visit([](const auto & x) { return broadphase::compute_bounds(x); }, s); }
+static std::vector<broadphase::aabb> compute_child_bounds(const std::vector<shape> & shapes)
+{
+    if(shapes.empty()) throw std::invalid_argument("compounds need at least one child");
+    std::vector<broadphase::aabb> bounds;
+    for(auto & s : shapes)
+    {
+        if(std::holds_alternative<compound>(s)) throw std::invalid_argument("compounds cannot contain compounds");
+        bounds.push_back(compute_bounds(s));
+    }
+    return bounds;
+}
+compound_children::compound_children(std::vector<shape> shapes) : shapes{move(shapes)}, bvh{compute_child_bounds(this->shapes)} {}
+
+float2 support(const compound & c, float2 direction)
+{
+    const float2 local_dir = rotate(c.rotation * float2{1,-1}, direction);
+    float2 best = std::visit([local_dir](const auto & s) { return support(s, local_dir); }, c.children->shapes[0]);
+    for(size_t i=1; i<c.children->shapes.size(); ++i)
+    {
+        const float2 p = std::visit([local_dir](const auto & s) { return support(s, local_dir); }, c.children->shapes[i]);
+        if(dot(p, local_dir) > dot(best, local_dir)) best = p;
+    }
+    return c.position + rotate(c.rotation, best);
+}
+
+// Invokes f(index, child) for every child of a compound, placed in the same space as the compound, whose bounds come within margin of 
+// the bounds of another shape. Those bounds are taken in the local space of the compound, where the BVH of its children was built.
+static broadphase::aabb compute_local_bounds(const compound & c, const shape & s)
+{
+    const float2 inverse = c.rotation * float2{1,-1};
+    return compute_bounds(transform(s, -rotate(inverse, c.position), inverse));
+}
+template<class F> static void for_each_child_near(const compound & c, const shape & s, float margin, F f)
+{
+    c.children->bvh.query(broadphase::expand(compute_local_bounds(c, s), margin), [&](int i) 
+    { 
+        f(i, transform(c.children->shapes[i], c.position, c.rotation)); 
+        return true; 
+    });
+}
+
+// Invokes f(index_a, index_b, child_a, child_b) for every pair of children of two shapes whose bounds come within margin of each other,
+// where shapes which are not compounds act as their only child, with an index of -1
+template<class F> static void for_each_child_pair(const shape & a, const shape & b, float margin, F f)
+{
+    const compound * compound_a = std::get_if<compound>(&a), * compound_b = std::get_if<compound>(&b);
+    if(!compound_a && !compound_b) return f(-1, -1, a, b);
+    if(!compound_a) return for_each_child_near(*compound_b, a, margin, [&](int j, const shape & child_b) { f(-1, j, a, child_b); });
+    for_each_child_near(*compound_a, b, margin, [&](int i, const shape & child_a)
+    {
+        if(!compound_b) return f(i, -1, child_a, b);
+        for_each_child_near(*compound_b, child_a, margin, [&](int j, const shape & child_b) { f(i, j, child_a, child_b); });
+    });
+}
+
+// Queries on children count their work into the cache of the query on the compound, but are warm started separately, as the cached 
+// direction of one pair of children says little about another
+static void add_child_work(collision::gjk_cache & cache, const collision::gjk_cache & child_cache)
+{
+    cache.iterations += child_cache.iterations;
+    cache.used_epa = cache.used_epa || child_cache.used_epa;
+}
+
+// Sweeps involving a compound visit its children in the order that the bounds of the other shape reach them, moving by translation 
+// through the local space of the compound, and clip the sweep to the nearest hit so far
+template<class CastChild> static std::optional<collision::cast_hit> cast_children(const compound & c, const shape & s, const float2 & translation, float max_t, CastChild cast_child)
+{
+    std::optional<collision::cast_hit> nearest;
+    c.children->bvh.boxcast(compute_local_bounds(c, s), rotate(c.rotation * float2{1,-1}, translation), max_t, [&](int i, float max_t)
+    {
+        const auto hit = cast_child(transform(c.children->shapes[i], c.position, c.rotation), max_t);
+        if(!hit) return max_t;
+        nearest = hit;
+        return hit->t;
+    });
+    return nearest;
+}
+
+std::optional<collision::cast_hit> cast_ray(const shape & s, const float2 & origin, const float2 & direction, float max_t)
+{
+    if(auto c = std::get_if<compound>(&s)) return cast_children(*c, circle{origin, 0}, direction, max_t, [&](const shape & child, float max_t) { return cast_ray(child, origin, direction, max_t); });
+    return std::visit([&](const auto & x) { return collision::cast_ray(make_support_function(x), origin, direction, max_t); }, s);
+}
+
+std::optional<collision::cast_hit> cast_shape(const shape & a, const float2 & translation, const shape & b, float max_t)
+{
+    if(auto c = std::get_if<compound>(&b)) return cast_children(*c, a, translation, max_t, [&](const shape & child, float max_t) { return cast_shape(a, translation, child, max_t); });
+    if(auto c = std::get_if<compound>(&a)) return cast_children(*c, b, -translation, max_t, [&](const shape & child, float max_t) { return cast_shape(child, translation, b, max_t); });
+    return std::visit([&](const auto & x, const auto & y) { return collision::cast_shape(make_support_function(x), translation, make_support_function(y), max_t); }, a, b);
+}
+
+std::optional<float> find_time_of_impact(const shape & a, const sweep & sweep_a, const shape & b, const sweep & sweep_b, float target_distance, collision::gjk_cache & cache)
+{
+    const auto toi = std::visit([&](const auto & local_a, const auto & local_b)
+    {
+        const auto at = [](const auto & local_shape, const sweep & s) 
+        { 
+            return [&local_shape, &s](float t) 
+            { 
+                const float orientation = s.orientation + s.rotation*t;
+                return make_support_function(transform(local_shape, s.position + s.displacement*t, float2{std::cos(orientation), std::sin(orientation)})); 
+            }; 
+        };
+        return collision::find_time_of_impact(at(local_a, sweep_a), collision::motion_bound{sweep_a.displacement, std::abs(sweep_a.rotation)*get_bounding_radius(local_a)},
+                                              at(local_b, sweep_b), collision::motion_bound{sweep_b.displacement, std::abs(sweep_b.rotation)*get_bounding_radius(local_b)}, target_distance, cache);
+    }, a, b);
+    record_stats(a, b, cache);
+    return toi;
+}
+
+std::optional<collision::penetration> find_intersection(const circle & a, const circle & b, collision::gjk_cache &) { return collision::find_circle_circle_intersection(a.center, a.radius, b.center, b.radius); }
+std::optional<collision::penetration> find_intersection(const circle & a, const posed_box & b, collision::gjk_cache &) { return collision::find_circle_box_intersection(a.center, a.radius, b.position, b.rotation, b.half_extent); }
+std::optional<collision::penetration> find_intersection(const circle & a, const segment & b, collision::gjk_cache &) { return collision::find_circle_segment_intersection(a.center, a.radius, b.p0, b.p1); }
+// Vertices of polygonal shapes with at most max_sides vertices, or none for shapes with curved boundaries
+static int get_polygon(const circle &, float2 *) { return 0; }
+static int get_polygon(const posed_box & b, float2 * points) { const auto v = get_vertices(b); std::copy(v.points, v.points+4, points); return 4; }
+static int get_polygon(const segment & s, float2 * points) { points[0] = s.p0; points[1] = s.p1; return 2; }
+static int get_polygon(const convex_polygon & p, float2 * points) { std::copy(p.points, p.points+6, points); return 6; }
+static int get_polygon(const regular_polygon & p, float2 * points) { for(int i=0; i<p.sides; ++i) points[i] = get_vertex(p, i); return p.sides; }
+static int get_polygon(const compound &, float2 *) { return 0; } // Manifolds of compounds are found between their children
+
+template<class ShapeA, class ShapeB> static std::optional<collision::penetration> find_polygon_intersection(const ShapeA & a, const ShapeB & b)
+{
+    float2 points_a[max_sides], points_b[max_sides];
+    const int count_a = get_polygon(a, points_a), count_b = get_polygon(b, points_b);
+    return collision::find_polygon_intersection(points_a, count_a, points_b, count_b);
+}
+std::optional<collision::penetration> find_intersection(const posed_box & a, const posed_box & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const posed_box & a, const segment & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const posed_box & a, const convex_polygon & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const convex_polygon & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const segment & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const regular_polygon & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const posed_box & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const convex_polygon & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const segment & b, collision::gjk_cache &) { return find_polygon_intersection(a, b); }
+
+// Mirrored pairs reuse the solutions above, with the roles of the shapes exchanged
+template<class ShapeA, class ShapeB> static std::optional<collision::penetration> find_reversed_intersection(const ShapeA & a, const ShapeB & b, collision::gjk_cache & cache)
+{
+    cache.direction = -cache.direction; // Minkowski difference B-A is the reflection of A-B
+    std::swap(cache.support_hints[0], cache.support_hints[1]);
+    auto pen = ::find_intersection(b, a, cache);
+    std::swap(cache.support_hints[0], cache.support_hints[1]);
+    cache.direction = -cache.direction;
+    if(pen) return pen->reversed();
+    return std::nullopt;
+}
+std::optional<collision::penetration> find_intersection(const posed_box & a, const circle & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const segment & a, const circle & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const segment & a, const posed_box & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const posed_box & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const segment & a, const convex_polygon & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const posed_box & a, const regular_polygon & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const regular_polygon & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+std::optional<collision::penetration> find_intersection(const segment & a, const regular_polygon & b, collision::gjk_cache & cache) { return find_reversed_intersection(a, b, cache); }
+
+// Table of narrowphase functions indexed by the alternative indices of both shapes. Overload resolution selects the most specific
+// find_intersection for each entry at compile time.
+using narrowphase_function = std::optional<collision::penetration> (*)(const shape &, const shape &, collision::gjk_cache &);
+template<size_t I, size_t J> static std::optional<collision::penetration> dispatch(const shape & a, const shape & b, collision::gjk_cache & cache)
+{
+    return ::find_intersection(*std::get_if<I>(&a), *std::get_if<J>(&b), cache); // Qualified, as gjk_cache would otherwise bring collision::find_intersection in through ADL
+}
+template<size_t... K> static constexpr std::array<narrowphase_function, sizeof...(K)> make_dispatch_table(std::index_sequence<K...>)
+{
+    constexpr size_t n = std::variant_size_v<shape>;
+    return {{&dispatch<K/n, K%n>...}};
+}
+static constexpr auto dispatch_table = make_dispatch_table(std::make_index_sequence<std::variant_size_v<shape> * std::variant_size_v<shape>>{});
+
+std::optional<collision::penetration> find_intersection(const shape & a, const shape & b, collision::gjk_cache & cache)
+{
+    cache.iterations = 0;
+    cache.used_epa = false;
+    auto pen = dispatch_table[a.index() * std::variant_size_v<shape> + b.index()](a, b, cache);
+    record_stats(a, b, cache);
+    return pen;
+}
+
+std::optional<collision::penetration> find_compound_intersection(const shape & a, const shape & b, collision::gjk_cache & cache)
+{
+    std::optional<collision::penetration> deepest;
+    for_each_child_pair(a, b, 0, [&](int, int, const shape & child_a, const shape & child_b)
+    {
+        collision::gjk_cache child_cache;
+        const auto pen = find_intersection(child_a, child_b, child_cache);
+        add_child_work(cache, child_cache);
+        if(pen && (!deepest || pen->d > deepest->d)) deepest = pen;
+    });
+    return deepest;
+}
+
+// Pairs of shape types with one of the closed-form or separating axis overloads of find_intersection above
+template<class Shape> constexpr bool is_sat_polygon = std::is_same_v<Shape, posed_box> || std::is_same_v<Shape, segment> || std::is_same_v<Shape, convex_polygon> || std::is_same_v<Shape, regular_polygon>;
+template<class Shape> constexpr bool has_circle_solution = std::is_same_v<Shape, circle> || std::is_same_v<Shape, posed_box> || std::is_same_v<Shape, segment>;
+template<class ShapeA, class ShapeB> constexpr bool has_closed_form = (is_sat_polygon<ShapeA> && is_sat_polygon<ShapeB> && !(std::is_same_v<ShapeA, segment> && std::is_same_v<ShapeB, segment>))
+    || (std::is_same_v<ShapeA, circle> && has_circle_solution<ShapeB>) || (std::is_same_v<ShapeB, circle> && has_circle_solution<ShapeA>);
+
+// Contact for a specific pair of shape types. Pairs without a closed-form solution find the penetration, or the closest points of
+// separated shapes, with a single distance query between their cores, while the others only fall back to it when they do not touch.
+template<class ShapeA, class ShapeB> static std::optional<collision::penetration> find_pair_contact(const ShapeA & a, const ShapeB & b, collision::gjk_cache & cache, float max_distance)
+{
+    if constexpr(has_closed_form<ShapeA, ShapeB>)
+    {
+        if(auto pen = ::find_intersection(a, b, cache)) return pen;
+        if(!(max_distance > 0)) return std::nullopt;
+    }
+    return collision::find_rounded_intersection(get_core_support(a, &cache.support_hints[0]), get_radius(a), get_core_support(b, &cache.support_hints[1]), get_radius(b), cache, max_distance);
+}
+// Compounds are handled child by child in find_contact
+static std::optional<collision::penetration> find_pair_contact(const compound &, const compound &, collision::gjk_cache &, float) { return std::nullopt; }
+template<class Shape> static std::optional<collision::penetration> find_pair_contact(const Shape &, const compound &, collision::gjk_cache &, float) { return std::nullopt; }
+template<class Shape> static std::optional<collision::penetration> find_pair_contact(const compound &, const Shape &, collision::gjk_cache &, float) { return std::nullopt; }
+
+std::optional<collision::penetration> find_contact(const shape & a, const shape & b, collision::gjk_cache & cache, float max_distance)
+{
+    if(std::holds_alternative<compound>(a) || std::holds_alternative<compound>(b))
+    {
+        cache.iterations = 0;
+        cache.used_epa = false;
+        std::optional<collision::penetration> deepest;
+        for_each_child_pair(a, b, max_distance, [&](int, int, const shape & child_a, const shape & child_b)
+        {
+            collision::gjk_cache child_cache;
+            const auto pen = find_contact(child_a, child_b, child_cache, max_distance);
+            add_child_work(cache, child_cache);
+            if(pen && (!deepest || pen->d > deepest->d)) deepest = pen;
+        });
+        return deepest;
+    }
+
+    cache.iterations = 0;
+    cache.used_epa = false;
+    auto pen = std::visit([&cache, max_distance](const auto & a, const auto & b) { return find_pair_contact(a, b, cache, max_distance); }, a, b);
+    record_stats(a, b, cache);
+    return pen;
+}
+
+// Feature edges of polygonal shapes, found from their support vertex and its neighbours. Hulls search from the vertex hinted by the query.
+static std::optional<collision::feature_edge> get_feature_edge(const hull_polygon & h, const float2 & direction, int hint)
+{
+    const int i = find_support_index(h, rotate(h.rotation * float2{1,-1}, direction), hint);
+    auto vertex = [&h](int j) { return h.position + rotate(h.rotation, h.points[j % h.count]); };
+    return collision::find_feature_edge(vertex(i+h.count-1), vertex(i), vertex(i+1), i, h.count, direction);
+}
+template<class Shape> static std::optional<collision::feature_edge> get_feature_edge(const Shape & s, const float2 & direction, int)
+{
+    float2 points[max_sides];
+    const int count = get_polygon(s, points);
+    if(!count) return std::nullopt;
+    return collision::find_feature_edge(points, count, direction);
+}
+template<class Core> static std::optional<collision::feature_edge> get_feature_edge(const rounded<Core> & r, const float2 & direction, int hint) { return get_feature_edge(r.core, direction, hint); }
+
+static float get_depth(const collision::manifold & m) { float d = m.points[0].d; for(int i=1; i<m.count; ++i) d = std::max(d, m.points[i].d); return d; }
+collision::manifold find_manifold(const shape & a, const shape & b, collision::gjk_cache & cache, float max_distance)
+{
+    if(std::holds_alternative<compound>(a) || std::holds_alternative<compound>(b))
+    {
+        cache.iterations = 0;
+        cache.used_epa = false;
+        collision::manifold deepest {};
+        for_each_child_pair(a, b, max_distance, [&](int, int, const shape & child_a, const shape & child_b)
+        {
+            collision::gjk_cache child_cache;
+            const auto m = find_manifold(child_a, child_b, child_cache, max_distance);
+            add_child_work(cache, child_cache);
+            if(m.count && (!deepest.count || get_depth(m) > get_depth(deepest))) deepest = m;
+        });
+        return deepest;
+    }
+
+    const auto contact = find_contact(a, b, cache, max_distance);
+    if(!contact) return {};
+    const float2 n = contact->normal_a_to_b();
+    const auto edge_a = std::visit([&](const auto & s) { return get_feature_edge(s, n, cache.support_hints[0]); }, a);
+    const auto edge_b = std::visit([&](const auto & s) { return get_feature_edge(s, -n, cache.support_hints[1]); }, b);
+    if(!edge_a || !edge_b) return {{*contact}, {collision::unmatched_contact_id}, 1};
+
+    // Manifolds of rounded shapes are found between their cores, then pushed out to their surfaces
+    const float radius_a = std::visit([](const auto & s) { return get_radius(s); }, a), radius_b = std::visit([](const auto & s) { return get_radius(s); }, b);
+    const collision::penetration core_contact {contact->p - n*radius_a, n, contact->d - radius_a - radius_b};
+    auto m = collision::find_manifold(*edge_a, *edge_b, core_contact, max_distance + radius_a + radius_b);
+    for(int i=0; i<m.count; ++i) m.points[i] = {m.points[i].p + m.points[i].n*radius_a, m.points[i].n, m.points[i].d + radius_a + radius_b};
+    return m;
+}
+
+void find_child_manifolds(const shape & a, const shape & b, float max_distance, std::vector<child_manifold> & manifolds)
+{
+    for_each_child_pair(a, b, max_distance, [&](int i, int j, const shape & child_a, const shape & child_b)
+    {
+        collision::gjk_cache cache;
+        const auto m = find_manifold(child_a, child_b, cache, max_distance);
+        if(m.count) manifolds.push_back({i, j, m, cache.used_epa});
+    });
+}
+
+// Splits the edges into maximal runs along which x never decreases, or never increases. Edges of constant x join whichever run they are in.
+static std::vector<chain::run> find_monotone_runs(const std::vector<float2> & points, bool loop)
+{
+    if(points.size() < 2) throw std::invalid_argument("chains need at least two vertices");
+    const int n = static_cast<int>(points.size()), edge_count = loop ? n : n-1;
+    std::vector<chain::run> runs;
+    int first = 0, direction = 0;
+    for(int i=0; i<edge_count; ++i)
+    {
+        const float dx = points[(i+1)%n].x - points[i].x;
+        const int d = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+        if(d && direction && d != direction)
+        {
+            runs.push_back({first, i, direction > 0});
+            first = i;
+        }
+        if(d) direction = d;
+    }
+    runs.push_back({first, edge_count, direction >= 0});
+    return runs;
+}
+static std::vector<broadphase::aabb> compute_run_bounds(const std::vector<float2> & points, const std::vector<chain::run> & runs)
+{
+    std::vector<broadphase::aabb> bounds;
+    for(auto & r : runs)
+    {
+        broadphase::aabb box {points[r.first], points[r.first]};
+        for(int i=r.first+1; i<=r.last; ++i) box = {min(box.min, points[i % points.size()]), max(box.max, points[i % points.size()])};
+        bounds.push_back(box);
+    }
+    return bounds;
+}
+chain::chain(std::vector<float2> points, bool loop) : points{move(points)}, loop{loop}, runs{find_monotone_runs(this->points, loop)}, run_bvh{compute_run_bounds(this->points, runs)}
+{
+    const size_t n = this->points.size();
+    ghost_prev = this->points[0]*2.0f - this->points[1];
+    ghost_next = this->points[n-1]*2.0f - this->points[n-2];
+}
+chain::chain(std::vector<float2> points, const float2 & ghost_prev, const float2 & ghost_next) : points{move(points)}, ghost_prev{ghost_prev}, ghost_next{ghost_next}, loop{false}, runs{find_monotone_runs(this->points, false)}, run_bvh{compute_run_bounds(this->points, runs)} {}
+
+float2 chain::get_vertex(int i) const
+{
+    const int n = static_cast<int>(points.size());
+    if(loop) return points[(i%n + n) % n];
+    return i < 0 ? ghost_prev : i >= n ? ghost_next : points[i];
+}
+
+// Appends the manifold of a shape against the edge from v1 to v2 of a chain or heightfield, where v0 and v3 are the adjacent vertices. Contact normals which tilt away from the face of the edge come from its 
+// vertices, and are checked against the adjacent edge. At a convex vertex, each edge keeps the normals on its own side of the bisector of
+// the two face normals, leaving the rest to its neighbour. At a flat or concave vertex, the neighbour's face covers the vertex, so the 
+// contact is replaced by one against the face of the edge, which stops shapes sliding along a surface from catching on the join. Shapes
+// wholly behind the edge pass through it, while those reaching in front of it are pushed out to the front, however deep they have sunk, 
+// so contacts whose normal points out of the back of the face are also replaced by one against the face.
+static void find_edge_manifold(const shape & s, const float2 & center, int child, int edge, const float2 & v0, const float2 & v1, const float2 & v2, const float2 & v3, float max_distance, std::vector<child_manifold> & manifolds)
+{
+    const float2 d = normalize(v2 - v1), e {-d.y, d.x};
+    if(dot(std::visit([&e](const auto & x) { return support(x, e); }, s) - v1, e) < 0) return;
+
+    collision::gjk_cache cache {v1 - center};
+    const auto m = find_manifold(s, segment{v1, v2}, cache, max_distance);
+    collision::manifold result {};
+    bool has_face_contact = false;
+    const auto add_face_contact = [&](uint32_t id)
+    {
+        if(has_face_contact) return;
+        has_face_contact = true;
+        const float2 p = std::visit([&e](const auto & x) { return support(x, -e); }, s);
+        const collision::penetration face_contact {p, -e, dot(v1 - p, e)};
+        if(face_contact.d < -max_distance) return;
+        result.points[result.count] = face_contact;
+        result.ids[result.count++] = id;
+    };
+    for(int j=0; j<m.count; ++j)
+    {
+        const float2 normal = -m.points[j].n; // From the edge to the shape
+        if(dot(normal, e) < 0.9999f)
+        {
+            const float along = dot(m.points[j].point_on_b() - v1, d);
+            if(dot(normal, e) < 0 && along > 0 && along < dot(v2 - v1, d))
+            {
+                add_face_contact(m.ids[j]);
+                continue;
+            }
+            const bool at_start = dot(normal, d) < 0;
+            const float2 adjacent = normalize(at_start ? v1 - v0 : v3 - v2);
+            if(at_start ? cross(adjacent, d) < 0 : cross(d, adjacent) < 0)
+            {
+                // Normals exactly on the bisector go to the edge which starts at the vertex
+                const float2 bisector = normalize(e + float2{-adjacent.y, adjacent.x});
+                if(at_start ? dot(normal, e) < dot(bisector, e) : dot(normal, e) <= dot(bisector, e)) continue;
+            }
+            else
+            {
+                add_face_contact(m.ids[j]);
+                continue;
+            }
+        }
+        result.points[result.count] = m.points[j];
+        result.ids[result.count++] = m.ids[j];
+    }
+    if(result.count) manifolds.push_back({child, edge, result, cache.used_epa});
+}
+
+// Invokes f(index, child, bounds) for every child of a shape placed in world space, with its bounds grown by margin, where shapes which
+// are not compounds act as their only child, with an index of -1
+template<class F> static void for_each_child(const shape & s, float margin, F f)
+{
+    const auto visit = [&](int child, const shape & x) { f(child, x, broadphase::expand(compute_bounds(x), margin)); };
+    if(auto k = std::get_if<compound>(&s)) for(size_t i=0; i<k->children->shapes.size(); ++i) visit(static_cast<int>(i), transform(k->children->shapes[i], k->position, k->rotation));
+    else visit(-1, s);
+}
+
+void find_chain_manifolds(const shape & s, const chain & c, float max_distance, std::vector<child_manifold> & manifolds)
+{
+    for_each_child(s, max_distance, [&](int child, const shape & x, const broadphase::aabb & bounds)
+    {
+        const float2 center = (bounds.min + bounds.max) * 0.5f;
+        c.query(bounds, [&](int i)
+        {
+            find_edge_manifold(x, center, child, i, c.get_vertex(i-1), c.get_vertex(i), c.get_vertex(i+1), c.get_vertex(i+2), max_distance, manifolds);
+            return true;
+        });
+    });
+}
+
+template<class Sample> static void find_heightfield_manifolds(const shape & s, const heightfield<Sample> & h, float max_distance, std::vector<child_manifold> & manifolds)
+{
+    for_each_child(s, max_distance, [&](int child, const shape & x, const broadphase::aabb & bounds)
+    {
+        const float2 center = (bounds.min + bounds.max) * 0.5f;
+        const auto [first, last] = h.find_edges(bounds.min.x, bounds.max.x);
+        for(int i=first; i<last; ++i)
+        {
+            const float2 v1 = h.get_vertex(i), v2 = h.get_vertex(i+1);
+            if(std::max(v1.y, v2.y) < bounds.min.y) continue; // Edges wholly beneath the shape
+            find_edge_manifold(x, center, child, i, h.get_vertex(i-1), v1, v2, h.get_vertex(i+2), max_distance, manifolds);
+        }
+    });
+}
+void find_heightfield_manifolds(const shape & s, const heightfield<float> & h, float max_distance, std::vector<child_manifold> & manifolds) { find_heightfield_manifolds<float>(s, h, max_distance, manifolds); }
+void find_heightfield_manifolds(const shape & s, const heightfield<uint16_t> & h, float max_distance, std::vector<child_manifold> & manifolds) { find_heightfield_manifolds<uint16_t>(s, h, max_distance, manifolds); }
+
+heightfield<uint16_t> quantize(const heightfield<float> & h)
+{
+    const auto [lo, hi] = std::minmax_element(h.samples.begin(), h.samples.end());
+    const float low = *lo * h.scale, step = std::max((*hi - *lo) * h.scale / 65535, std::numeric_limits<float>::min());
+    heightfield<uint16_t> q {{h.origin.x, h.origin.y + low}, h.spacing, step, {}};
+    q.samples.reserve(h.samples.size());
+    for(float sample : h.samples) q.samples.push_back(static_cast<uint16_t>(std::round((sample * h.scale - low) / step)));
+    return q;
+}
+
+heightfield<float> generate_terrain(uint32_t seed, const float2 & origin, int sample_count, float spacing, float amplitude, int wavelength)
+{
+    std::mt19937 rng {seed};
+    std::uniform_real_distribution<float> value_dist(-1, 1);
+    heightfield<float> h {origin, spacing, 1, std::vector<float>(sample_count)};
+    for(; wavelength >= 2; wavelength /= 2, amplitude /= 2)
+    {
+        // Random values at every wavelength samples, joined by smoothstep curves
+        std::vector<float> values(sample_count / wavelength + 2);
+        for(auto & v : values) v = value_dist(rng) * amplitude;
+        for(int i=0; i<sample_count; ++i)
+        {
+            const int j = i / wavelength;
+            const float t = static_cast<float>(i % wavelength) / wavelength, s = t*t*(3 - 2*t);
+            h.samples[i] += values[j] + (values[j+1] - values[j])*s;
+        }
+    }
+    return h;
+}
@@ -0,0 +1,317 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include <variant>
+#include <cmath>
+#include <algorithm>
+#include <iosfwd>
+#include "collision.h"
+#include "static_bvh.h"
+
+struct circle { float2 center; float radius; };
+struct posed_box { float2 half_extent; float2 position; float2 rotation; }; // Rotation holds the cos and sin of the orientation
+struct segment { float2 p0, p1; };
+struct convex_polygon { float2 points[6]; };
+struct regular_polygon { float2 center, corner; int sides; }; // Corner is the offset from the center to the first vertex, at most max_sides sides
+struct hull_polygon { const float2 * points; int count; float2 position, rotation; }; // Counter-clockwise points in local space, owned elsewhere
+template<class Core> struct rounded { Core core; float radius; }; // Every point within radius of a convex core shape
+using capsule = rounded<segment>;
+using rounded_box = rounded<posed_box>;
+using rounded_polygon = rounded<regular_polygon>;
+struct compound_children;
+struct compound { const compound_children * children; float2 position, rotation; }; // Convex children in local space, owned elsewhere
+
+inline float2 rotate(const float2 & rotation, const float2 & v) { return {rotation.x*v.x - rotation.y*v.y, rotation.y*v.x + rotation.x*v.y}; } // Rotation as cos and sin
+
+// Regular polygons find their support vertex from the angle of the direction, in constant time regardless of the number of sides
+constexpr int max_sides = 16;
+struct unit_polygon_table
+{
+    float2 rotations[max_sides+1][max_sides]; // Rotation from the first vertex to vertex j of a polygon with i sides, as cos and sin
+    unit_polygon_table() { for(int i=1; i<=max_sides; ++i) for(int j=0; j<i; ++j) rotations[i][j] = {std::cos(j*6.28318531f/i), std::sin(j*6.28318531f/i)}; }
+};
+inline const unit_polygon_table unit_polygons;
+inline regular_polygon make_regular_polygon(const float2 & center, float radius, float orientation, int sides) { return {center, rot(orientation, float2{radius,0}), sides}; }
+inline float2 get_vertex(const regular_polygon & p, int i) { return p.center + rotate(unit_polygons.rotations[p.sides][i], p.corner); }
+
+// Polynomial approximation of atan2, accurate to about 1e-5 radians
+inline float approx_atan2(float y, float x)
+{
+    const float ax = std::abs(x), ay = std::abs(y), a = std::min(ax, ay) / std::max(ax, ay), s = a*a;
+    float r = ((-0.0464964749f*s + 0.15931422f)*s - 0.327622764f)*s*a + a;
+    if(ay > ax) r = 1.57079637f - r;
+    if(x < 0) r = 3.14159265f - r;
+    return y < 0 ? -r : r;
+}
+
+// Large polygons find their support vertex by hill-climbing along the boundary from a starting vertex. Pair queries start from the 
+// vertex found by the previous query, kept in gjk_cache::support_hints, which for coherent directions takes only a few steps.
+inline int find_support_index(const hull_polygon & h, const float2 & local_direction, int start=0)
+{
+    int i = start;
+    float best = dot(h.points[i], local_direction);
+    for(int step : {1, h.count-1})
+    {
+        while(true)
+        {
+            const int j = (i+step) % h.count;
+            const float d = dot(h.points[j], local_direction);
+            if(!(d > best)) break;
+            i = j;
+            best = d;
+        }
+    }
+    return i;
+}
+
+inline float2 support(circle c, float2 direction) { return c.center + normalize(direction) * c.radius; }
+inline float2 support(posed_box b, float2 direction) 
+{ 
+    float2 local_dir = rotate(b.rotation * float2{1,-1}, direction);
+    return b.position + rotate(b.rotation, float2{local_dir.x > 0 ? b.half_extent.x : -b.half_extent.x, local_dir.y > 0 ? b.half_extent.y : -b.half_extent.y});
+}
+inline float2 support(segment l, float2 direction) { return dot(direction, l.p1-l.p0) > 0 ? l.p1 : l.p0; }
+inline float2 support(convex_polygon p, float2 direction) 
+{ 
+    float2 best = p.points[0];
+    float best_d = dot(p.points[0], direction);
+    for(int i=1; i<6; ++i)
+    {
+        float d = dot(p.points[i], direction);
+        if(d > best_d)
+        {
+            best = p.points[i];
+            best_d = d;
+        }
+    }
+    return best;
+}
+
+inline float2 support(regular_polygon p, float2 direction) 
+{
+    // The vertex nearest in angle to the direction is compared against its neighbour on the far side of the direction, which can 
+    // only be better when the approximate angle is off near the bisector of the two
+    const float t = approx_atan2(cross(p.corner, direction), dot(p.corner, direction)) * (p.sides / 6.28318531f);
+    const int i = static_cast<int>(std::floor(t + 0.5f)), j = t > i ? i+1 : i-1;
+    const float2 a = get_vertex(p, (i + p.sides) % p.sides), b = get_vertex(p, (j + p.sides) % p.sides);
+    return dot(b, direction) > dot(a, direction) ? b : a;
+}
+inline float2 support(hull_polygon h, float2 direction) 
+{ 
+    const float2 local_dir = rotate(h.rotation * float2{1,-1}, direction);
+    return h.position + rotate(h.rotation, h.points[find_support_index(h, local_dir)]);
+}
+
+template<class Core> float2 support(const rounded<Core> & r, float2 direction) { return support(r.core, direction) + normalize(direction) * r.radius; }
+float2 support(const compound & c, float2 direction); // Support of the convex hull of the children
+
+template<class T> auto make_support_function(T shape) { return [shape](float2 direction) { return support(shape, direction); }; }
+
+// Support functions for a shape in a pair query, which may keep a hint between queries, owned by the caller. Only hulls use it.
+template<class T> auto make_support_function(T shape, int *) { return make_support_function(shape); }
+inline auto make_support_function(hull_polygon h, int * hint)
+{
+    return [h, hint](float2 direction) 
+    { 
+        *hint = find_support_index(h, rotate(h.rotation * float2{1,-1}, direction), *hint);
+        return h.position + rotate(h.rotation, h.points[*hint]);
+    };
+}
+
+// Rounded shapes collide through their cores. Circles are treated as rounded points, and every other shape as its own core with no radius.
+template<class Shape> constexpr bool is_rounded = false;
+template<class Core> constexpr bool is_rounded<rounded<Core>> = true;
+template<class Shape> auto get_core_support(const Shape & s, int * hint) { return make_support_function(s, hint); }
+template<class Core> auto get_core_support(const rounded<Core> & r, int * hint) { return make_support_function(r.core, hint); }
+inline auto get_core_support(const circle & c, int *) { return [center = c.center](float2) { return center; }; }
+template<class Shape> float get_radius(const Shape &) { return 0; }
+template<class Core> float get_radius(const rounded<Core> & r) { return r.radius; }
+inline float get_radius(const circle & c) { return c.radius; }
+
+using shape = std::variant<circle, posed_box, segment, convex_polygon, regular_polygon, hull_polygon, capsule, rounded_box, rounded_polygon, compound>;
+
+// Children of compound shapes, which may be any shape but another compound, with a BVH over their bounds in the space they are stored in
+struct compound_children
+{
+    std::vector<shape> shapes;
+    broadphase::static_bvh bvh;
+    explicit compound_children(std::vector<shape> shapes);
+};
+
+// Narrowphase for a specific pair of shape types. The generic version uses GJK and EPA, warm started from the cache, or for pairs 
+// involving a rounded shape, the distance between cores. The overloads for specific pairs use closed-form or separating axis solutions, 
+// which are much cheaper and leave the cache untouched.
+template<class ShapeA, class ShapeB> std::optional<collision::penetration> find_intersection(const ShapeA & a, const ShapeB & b, collision::gjk_cache & cache)
+{
+    if constexpr(is_rounded<ShapeA> || is_rounded<ShapeB>) return collision::find_rounded_intersection(get_core_support(a, &cache.support_hints[0]), get_radius(a), get_core_support(b, &cache.support_hints[1]), get_radius(b), cache);
+    else return collision::find_intersection(make_support_function(a, &cache.support_hints[0]), make_support_function(b, &cache.support_hints[1]), cache);
+}
+std::optional<collision::penetration> find_intersection(const circle & a, const circle & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const circle & a, const posed_box & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const posed_box & a, const circle & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const circle & a, const segment & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const segment & a, const circle & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const posed_box & a, const posed_box & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const posed_box & a, const segment & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const segment & a, const posed_box & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const posed_box & a, const convex_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const posed_box & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const convex_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const segment & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const segment & a, const convex_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const regular_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const posed_box & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const posed_box & a, const regular_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const convex_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const convex_polygon & a, const regular_polygon & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const regular_polygon & a, const segment & b, collision::gjk_cache & cache);
+std::optional<collision::penetration> find_intersection(const segment & a, const regular_polygon & b, collision::gjk_cache & cache);
+
+// Pairs involving a compound find the deepest penetration between any of their children, visiting only the children whose bounds overlap
+// the bounds of the other shape, through the BVH of the compound
+std::optional<collision::penetration> find_compound_intersection(const shape & a, const shape & b, collision::gjk_cache & cache);
+template<class ShapeB> std::optional<collision::penetration> find_intersection(const compound & a, const ShapeB & b, collision::gjk_cache & cache) { return find_compound_intersection(a, b, cache); }
+template<class ShapeA> std::optional<collision::penetration> find_intersection(const ShapeA & a, const compound & b, collision::gjk_cache & cache) { return find_compound_intersection(a, b, cache); }
+inline std::optional<collision::penetration> find_intersection(const compound & a, const compound & b, collision::gjk_cache & cache) { return find_compound_intersection(a, b, cache); }
+
+// Narrowphase counters for every pair of shape types, indexed by the alternative indices of both shapes. The queries on shapes below 
+// accumulate into these while COLLISION_STATS is defined, and they are otherwise left at zero.
+struct shape_pair_stats
+{
+    collision::narrowphase_stats pairs[std::variant_size_v<shape>][std::variant_size_v<shape>];
+    static void write_csv_header(std::ostream & out);
+    void write_csv(std::ostream & out, size_t frame) const; // One row for each pair of shape types with any work recorded
+};
+shape_pair_stats & get_narrowphase_stats(); // Never cleared, so callers wanting per frame counts should reset it after each frame
+
+// Moves a shape from body space to world space, given the position of the body and its rotation as cos and sin
+shape transform(const shape & local_shape, const float2 & position, const float2 & rotation);
+
+// Greatest distance of any point of a shape from the origin of the space it is stored in
+float get_bounding_radius(const shape & local_shape);
+
+// Motion of a body over a step, for continuous collision queries on shapes stored in body space. The body is assumed to move and rotate at
+// constant rates, starting from position and orientation.
+struct sweep { float2 position, displacement; float orientation, rotation; };
+
+// Finds the earliest fraction of the step at which two sweeping shapes come within target_distance of each other, as described for 
+// collision::find_time_of_impact. Static shapes may be stored in world space and given a sweep of all zeros. Compounds are swept as the
+// convex hull of their children, which can only make the time of impact earlier.
+std::optional<float> find_time_of_impact(const shape & a, const sweep & sweep_a, const shape & b, const sweep & sweep_b, float target_distance, collision::gjk_cache & cache);
+
+// Ray and shape casts against shapes in world space, as described for collision::cast_ray and collision::cast_shape
+std::optional<collision::cast_hit> cast_ray(const shape & s, const float2 & origin, const float2 & direction, float max_t);
+std::optional<collision::cast_hit> cast_shape(const shape & a, const float2 & translation, const shape & b, float max_t);
+
+// Narrowphase for any pair of shapes, dispatched through a table of the above functions built at compile time
+std::optional<collision::penetration> find_intersection(const shape & a, const shape & b, collision::gjk_cache & cache);
+
+// Finds the penetration of two shapes, or if they are separated by less than max_distance, their closest points as a penetration of
+// negative depth. The latter allow the solver to act on a contact before the shapes touch.
+std::optional<collision::penetration> find_contact(const shape & a, const shape & b, collision::gjk_cache & cache, float max_distance);
+
+// As find_contact, but produces up to two contact points when both shapes are polygonal, with IDs which persist between frames. For 
+// compounds, these are the deepest contact and manifold of any pair of children, so find_child_manifolds should be used to support them.
+collision::manifold find_manifold(const shape & a, const shape & b, collision::gjk_cache & cache, float max_distance);
+
+// Manifold between a child of each shape, where shapes which are not compounds act as their only child, with an index of -1. Used_epa 
+// records whether the query which found the manifold needed EPA, as gjk_cache::used_epa does for single queries.
+struct child_manifold { int child_a, child_b; collision::manifold manifold; bool used_epa; };
+
+// Appends the manifold of every pair of children within max_distance of each other, as found by find_manifold. IDs are only unique 
+// within a pair of children, so contact state should be keyed by the child indices as well.
+void find_child_manifolds(const shape & a, const shape & b, float max_distance, std::vector<child_manifold> & manifolds);
+
+// Static geometry made of edges through a sequence of shared vertices, in world space, where edge i runs from vertex i to vertex i+1.
+// Edges are one-sided, with solid ground to their right, pushing shapes out to their left and letting through only shapes wholly to 
+// their right, so chains should run left to right along the top of terrain, or clockwise around solid ground. Open chains have a ghost vertex beyond each end, standing in for whatever geometry continues
+// the chain, so that contacts near their ends are as smooth as those between their edges. Loops join their last vertex to the first.
+// Edges are found through the runs of the chain along which x only increases, or only decreases. Within a run, the edges spanning an 
+// interval of x are found by bisection, so only the runs need bounds, and chains over terrain, with a run for each overhang, take little 
+// more memory than their vertices, half that of discrete segments. For ground which is a function of x, a heightfield is smaller still.
+struct chain
+{
+    struct run { int first, last; bool increasing; }; // Edges from first up to but not including last, along which x is monotone
+
+    std::vector<float2> points;
+    float2 ghost_prev, ghost_next;
+    bool loop;
+    std::vector<run> runs;
+    broadphase::static_bvh run_bvh; // Over the bounds of the runs
+
+    chain(std::vector<float2> points, bool loop); // Ghost vertices of open chains continue their end edges in a straight line
+    chain(std::vector<float2> points, const float2 & ghost_prev, const float2 & ghost_next);
+
+    int get_edge_count() const { return static_cast<int>(points.size()) - (loop ? 0 : 1); }
+    float2 get_vertex(int i) const; // From -1 to the number of vertices, giving the ghost vertices at either end, or wrapping around loops
+    segment get_edge(int i) const { return {get_vertex(i), get_vertex(i+1)}; }
+
+    // Invokes callback(i) for every edge whose bounds overlap the region, stopping early if the callback returns false
+    template<class Callback> void query(const broadphase::aabb & region, Callback callback) const
+    {
+        run_bvh.query(region, [&](int r)
+        {
+            // Bisect for the first edge whose far end reaches the region along the direction of the run
+            const run & k = runs[r];
+            int lo = k.first, hi = k.last;
+            while(lo < hi)
+            {
+                const int mid = (lo + hi) / 2;
+                if(k.increasing ? get_vertex(mid+1).x < region.min.x : get_vertex(mid+1).x > region.max.x) lo = mid+1;
+                else hi = mid;
+            }
+            for(int i=lo; i<k.last; ++i)
+            {
+                const float2 v0 = get_vertex(i), v1 = get_vertex(i+1);
+                if(k.increasing ? v0.x > region.max.x : v0.x < region.min.x) break;
+                if(std::max(v0.y, v1.y) >= region.min.y && std::min(v0.y, v1.y) <= region.max.y && !callback(i)) return false;
+            }
+            return true;
+        });
+    }
+};
+
+// Appends the manifold of a shape against every edge of a chain within max_distance of it, with the edge index as child_b. Only edges 
+// whose bounds come within max_distance of the bounds of the shape are examined. Contacts at vertices are corrected using the adjacent
+// edges, so that shapes slide across the joins between edges without catching on them.
+void find_chain_manifolds(const shape & s, const chain & c, float max_distance, std::vector<child_manifold> & manifolds);
+
+// Ground given by heights sampled at uniform spacing along x, in world space, where vertex i lies at origin + {i*spacing, samples[i]*scale}.
+// Solid ground lies beneath the profile, between the first and last samples. Beyond either end, a ghost vertex continues the profile 
+// in a straight line, as with open chains, which only smooths contacts near the ends, as no edges lie beyond them. Samples may be floats, 
+// or 16 bit integers quantized to steps of scale, which halve the memory. There must be at least two samples.
+template<class Sample> struct heightfield
+{
+    float2 origin;
+    float spacing, scale;
+    std::vector<Sample> samples;
+
+    int get_edge_count() const { return static_cast<int>(samples.size()) - 1; }
+    float2 get_vertex(int i) const // From -1 to the number of samples, giving the ghost vertices at either end
+    {
+        const int n = static_cast<int>(samples.size());
+        if(i < 0) return get_vertex(0)*2.0f - get_vertex(1);
+        if(i >= n) return get_vertex(n-1)*2.0f - get_vertex(n-2);
+        return origin + float2{i*spacing, samples[i]*scale};
+    }
+    segment get_edge(int i) const { return {get_vertex(i), get_vertex(i+1)}; }
+
+    // Range [first, last) of the edges spanning min_x to max_x, found directly from the spacing
+    std::pair<int, int> find_edges(float min_x, float max_x) const
+    {
+        const float first = std::floor((min_x - origin.x) / spacing), last = std::ceil((max_x - origin.x) / spacing);
+        const float edges = static_cast<float>(get_edge_count());
+        return {static_cast<int>(std::clamp(first, 0.0f, edges)), static_cast<int>(std::clamp(last, 0.0f, edges))};
+    }
+};
+
+// As find_chain_manifolds, with the edge index as child_b, for the edges beneath the bounds of the shape
+void find_heightfield_manifolds(const shape & s, const heightfield<float> & h, float max_distance, std::vector<child_manifold> & manifolds);
+void find_heightfield_manifolds(const shape & s, const heightfield<uint16_t> & h, float max_distance, std::vector<child_manifold> & manifolds);
+
+// Stores the heights of a heightfield in 16 bits, spread over the range between its lowest and highest samples
+heightfield<uint16_t> quantize(const heightfield<float> & h);
+
+// Generates rolling terrain for demos and benchmarks, as the sum of octaves of smoothly interpolated random values. The first octave 
+// varies by up to amplitude every wavelength samples, and each further octave has half the amplitude and wavelength of the one before.
+heightfield<float> generate_terrain(uint32_t seed, const float2 & origin, int sample_count, float spacing, float amplitude, int wavelength);
@@ -0,0 +1,208 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "spatial_hash.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cmath>
+
+namespace broadphase
+{
+    // Threads which are started once and then wait to be given work, as starting threads on every call to find_pairs would cost more 
+    // than the work they share
+    class worker_pool
+    {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable start, done;
+        std::function<void(unsigned)> task;
+        uint64_t generation = 0;    // Incremented for every task, so that each worker runs each task once
+        unsigned busy = 0;          // Workers still running the current task
+        bool stopping = false;
+
+        void work(unsigned thread)
+        {
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true)
+            {
+                start.wait(lock, [&] { return stopping || generation != seen; });
+                if(stopping) return;
+                seen = generation;
+                lock.unlock();
+                task(thread);
+                lock.lock();
+                if(--busy == 0) done.notify_one();
+            }
+        }
+    public:
+        explicit worker_pool(unsigned threads) { for(unsigned t=1; t<threads; ++t) workers.emplace_back([this, t] { work(t); }); }
+        ~worker_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            start.notify_all();
+            for(auto & w : workers) w.join();
+        }
+
+        // Calls f(thread) once on every thread, with the calling thread as thread 0, blocking until all have finished
+        void run(std::function<void(unsigned)> f)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = move(f);
+                busy = static_cast<unsigned>(workers.size());
+                ++generation;
+            }
+            start.notify_all();
+            task(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return busy == 0; });
+        }
+    };
+
+    // Splits [0,count) into one contiguous range per thread and calls f(thread, begin, end) for each, blocking until all have finished.
+    // Threads other than the caller come from the pool, which must have been started with the given number of threads.
+    template<class F> static void parallel_for(worker_pool * pool, unsigned threads, size_t count, F f)
+    {
+        if(threads == 1) return f(0u, size_t(0), count);
+        pool->run([&](unsigned t) { f(t, count*t/threads, count*(t+1)/threads); });
+    }
+
+    static uint32_t hash_cell(int x, int y) { return static_cast<uint32_t>(x)*73856093u ^ static_cast<uint32_t>(y)*19349663u; }
+
+    spatial_hash::spatial_hash(float cell_size, unsigned thread_count) : thread_count{thread_count ? thread_count : std::max(std::thread::hardware_concurrency(), 1u)}, fixed_cell_size{cell_size} {}
+    spatial_hash::spatial_hash(spatial_hash &&) = default;
+    spatial_hash & spatial_hash::operator = (spatial_hash &&) = default;
+    spatial_hash::~spatial_hash() = default;
+
+    int spatial_hash::create_proxy(const aabb & box)
+    {
+        int proxy = static_cast<int>(boxes.size());
+        if(free_proxies.empty()) 
+        {
+            boxes.push_back(box);
+            live.push_back(true);
+        }
+        else
+        {
+            proxy = free_proxies.back();
+            free_proxies.pop_back();
+            boxes[proxy] = box;
+            live[proxy] = true;
+        }
+        return proxy;
+    }
+
+    void spatial_hash::destroy_proxy(int proxy)
+    {
+        live[proxy] = false;
+        free_proxies.push_back(proxy);
+    }
+
+    // Choose cells large enough that nearly all proxies fit within a single cell, and therefore overlap at most four cells
+    void spatial_hash::choose_cell_size()
+    {
+        if(fixed_cell_size > 0 || proxies.empty())
+        {
+            cell_size = fixed_cell_size > 0 ? fixed_cell_size : 1;
+            return;
+        }
+        double sum = 0, sum_sq = 0;
+        for(int proxy : proxies)
+        {
+            const float size = maxelem(boxes[proxy].max - boxes[proxy].min);
+            sum += size;
+            sum_sq += size*size;
+        }
+        const double mean = sum/proxies.size(), variance = std::max(sum_sq/proxies.size() - mean*mean, 0.0);
+        cell_size = static_cast<float>(mean + 2*std::sqrt(variance));
+        if(!(cell_size > 0)) cell_size = 1;
+    }
+
+    void spatial_hash::find_pairs(std::vector<pair> & pairs)
+    {
+        proxies.clear();
+        for(int i=0, n=static_cast<int>(boxes.size()); i<n; ++i) if(live[i]) proxies.push_back(i);
+        choose_cell_size();
+
+        // Small scenes are not worth the cost of waking threads
+        const unsigned threads = proxies.size() < 4096 ? 1 : thread_count;
+        if(threads > 1 && !pool) pool = std::make_unique<worker_pool>(threads);
+        const uint32_t bucket_count = [n = proxies.size()*2]() { uint32_t b = 1; while(b < n) b *= 2; return b; }(), mask = bucket_count-1;
+        const float inv_cell_size = 1/cell_size;
+        auto for_each_cell = [this, inv_cell_size](int proxy, auto f)
+        {
+            const aabb & box = boxes[proxy];
+            const int x0 = static_cast<int>(std::floor(box.min.x*inv_cell_size)), x1 = static_cast<int>(std::floor(box.max.x*inv_cell_size));
+            const int y0 = static_cast<int>(std::floor(box.min.y*inv_cell_size)), y1 = static_cast<int>(std::floor(box.max.y*inv_cell_size));
+            for(int y=y0; y<=y1; ++y) for(int x=x0; x<=x1; ++x) f(x, y);
+        };
+
+        // Count the number of entries each thread will write into each bucket
+        histograms.assign(size_t(threads)*bucket_count, 0);
+        parallel_for(pool.get(), threads, proxies.size(), [&](unsigned t, size_t begin, size_t end)
+        {
+            uint32_t * histogram = histograms.data() + size_t(t)*bucket_count;
+            for(size_t i=begin; i<end; ++i) for_each_cell(proxies[i], [=](int x, int y) { ++histogram[hash_cell(x,y) & mask]; });
+        });
+
+        // Convert counts to write offsets, ordered by bucket and then by thread, so the result does not depend on the thread count
+        bucket_start.resize(bucket_count+1);
+        uint32_t offset = 0;
+        for(uint32_t b=0; b<bucket_count; ++b)
+        {
+            bucket_start[b] = offset;
+            for(unsigned t=0; t<threads; ++t)
+            {
+                const uint32_t count = histograms[size_t(t)*bucket_count + b];
+                histograms[size_t(t)*bucket_count + b] = offset;
+                offset += count;
+            }
+        }
+        bucket_start[bucket_count] = offset;
+
+        // Scatter entries into their buckets
+        entries.resize(offset);
+        parallel_for(pool.get(), threads, proxies.size(), [&](unsigned t, size_t begin, size_t end)
+        {
+            uint32_t * next = histograms.data() + size_t(t)*bucket_count;
+            for(size_t i=begin; i<end; ++i) for_each_cell(proxies[i], [=](int x, int y) { entries[next[hash_cell(x,y) & mask]++] = {x, y, proxies[i]}; });
+        });
+
+        // Emit overlapping pairs which share a cell. Since two proxies may share several cells, and distinct cells may share a bucket,
+        // a pair is only emitted from the cell containing the lower corner of the intersection of their bounds.
+        thread_pairs.resize(threads);
+        parallel_for(pool.get(), threads, bucket_count, [&](unsigned t, size_t begin, size_t end)
+        {
+            auto & out = thread_pairs[t];
+            out.clear();
+            for(size_t bucket=begin; bucket<end; ++bucket)
+            {
+                const uint32_t bucket_end = bucket_start[bucket+1];
+                for(uint32_t i=bucket_start[bucket]; i<bucket_end; ++i)
+                {
+                    const entry & ei = entries[i];
+                    const aabb & a = boxes[ei.proxy];
+                    for(uint32_t j=i+1; j<bucket_end; ++j)
+                    {
+                        const entry & ej = entries[j];
+                        if(ei.x != ej.x || ei.y != ej.y || ei.proxy == ej.proxy) continue;
+                        const aabb & b = boxes[ej.proxy];
+                        if(!overlaps(a, b)) continue;
+                        const float2 corner = max(a.min, b.min);
+                        if(static_cast<int>(std::floor(corner.x*inv_cell_size)) != ei.x || static_cast<int>(std::floor(corner.y*inv_cell_size)) != ei.y) continue;
+                        out.push_back({std::min(ei.proxy, ej.proxy), std::max(ei.proxy, ej.proxy)});
+                    }
+                }
+            }
+        });
+
+        pairs.clear();
+        for(auto & p : thread_pairs) pairs.insert(end(pairs), begin(p), end(p));
+        stats = {proxies.size(), pairs.size(), proxies.size() ? proxies.size()*(proxies.size()-1)/2 : 0};
+    }
+}
@@ -0,0 +1,47 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include "broadphase.h"
+#include <cstdint>
+#include <memory>
+
+namespace broadphase
+{
+    // Uniform grid broadphase, with grid cells hashed into a fixed number of buckets. The grid is rebuilt from scratch on each
+    // call to find_pairs, using a counting sort of (cell, proxy) entries into one flat array, with the work split across threads.
+    class worker_pool;
+    class spatial_hash
+    {
+        struct entry { int x, y, proxy; };
+        std::vector<aabb> boxes;            // Indexed by proxy ID
+        std::vector<bool> live;             // Indexed by proxy ID
+        std::vector<int> free_proxies;      // Proxy IDs available for reuse
+        std::vector<int> proxies;           // Scratch list of live proxy IDs
+        std::vector<uint32_t> histograms;   // Per-thread entry counts for each bucket
+        std::vector<uint32_t> bucket_start; // Index into entries of the first entry in each bucket, plus one past the end
+        std::vector<entry> entries;         // (cell, proxy) entries, sorted by bucket
+        std::vector<std::vector<pair>> thread_pairs;
+        unsigned thread_count;
+        std::unique_ptr<worker_pool> pool;  // Started by the first call to find_pairs with enough proxies to use threads
+        float fixed_cell_size, cell_size = 1;
+        pair_stats stats {};
+
+        void choose_cell_size();
+    public:
+        // If cell_size is zero, a cell size will be chosen on each call to find_pairs based on the distribution of proxy sizes
+        explicit spatial_hash(float cell_size = 0, unsigned thread_count = 0);
+        spatial_hash(spatial_hash &&);
+        spatial_hash & operator = (spatial_hash &&);
+        ~spatial_hash();
+
+        int create_proxy(const aabb & box);
+        void destroy_proxy(int proxy);
+        void move_proxy(int proxy, const aabb & box) { boxes[proxy] = box; }
+        const aabb & get_bounds(int proxy) const { return boxes[proxy]; }
+        float get_cell_size() const { return cell_size; }
+
+        // Replaces the contents of pairs with all pairs of proxies whose bounds overlap
+        void find_pairs(std::vector<pair> & pairs);
+        const pair_stats & get_stats() const { return stats; }
+    };
+}
@@ -0,0 +1,102 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#include "static_bvh.h"
+
+namespace broadphase
+{
+    static_bvh::static_bvh(const std::vector<aabb> & boxes, int max_leaf_size) : max_leaf_size{std::max(max_leaf_size, 1)}
+    {
+        if(boxes.empty()) return;
+        items.reserve(boxes.size());
+        for(int i=0, n=static_cast<int>(boxes.size()); i<n; ++i) items.push_back({boxes[i], i});
+
+        // Leaves usually hold close to max_leaf_size items, and any excess from leaves holding fewer is trimmed once the tree is built
+        nodes.reserve(2*((items.size() + this->max_leaf_size - 1) / this->max_leaf_size));
+        nodes.push_back({});
+        build(0, 0, static_cast<int>(items.size()), 0);
+        nodes.shrink_to_fit();
+    }
+
+    static float2 centroid(const aabb & box) { return (box.min + box.max) * 0.5f; }
+
+    void static_bvh::build(int node_index, int begin, int end, int depth)
+    {
+        aabb box = items[begin].box, centroid_box = {centroid(box), centroid(box)};
+        for(int i=begin+1; i<end; ++i) 
+        {
+            box = combine(box, items[i].box);
+            centroid_box = combine(centroid_box, {centroid(items[i].box), centroid(items[i].box)});
+        }
+        nodes[node_index] = {box, begin, end - begin};
+        if(end - begin <= max_leaf_size) return;
+        if(depth >= max_sah_depth) return split(node_index, begin, (begin + end) / 2, end, depth);
+
+        // Bin item centroids along each axis, and find the split plane with the lowest surface area heuristic cost
+        constexpr int bin_count = 16;
+        const float leaf_cost = perimeter(box) * (end - begin);
+        float best_cost = leaf_cost; 
+        int best_axis = -1, best_split = 0;
+        for(int axis=0; axis<2; ++axis)
+        {
+            const float lo = centroid_box.min[axis], extent = centroid_box.max[axis] - lo;
+            if(!(extent > 0)) continue;
+            struct { aabb box; int count; } bins[bin_count] {};
+            for(int i=begin; i<end; ++i)
+            {
+                auto & bin = bins[std::min(static_cast<int>((centroid(items[i].box)[axis] - lo) / extent * bin_count), bin_count-1)];
+                bin.box = bin.count ? combine(bin.box, items[i].box) : items[i].box;
+                ++bin.count;
+            }
+
+            // Sweep from the right to accumulate costs of the right-hand partitions, then from the left to evaluate each split
+            float right_cost[bin_count];
+            aabb right_box = bins[bin_count-1].box; 
+            int right_count = 0;
+            for(int i=bin_count-1; i>0; --i)
+            {
+                if(bins[i].count) right_box = right_count ? combine(right_box, bins[i].box) : bins[i].box;
+                right_count += bins[i].count;
+                right_cost[i] = right_count ? perimeter(right_box) * right_count : 0;
+            }
+            aabb left_box = bins[0].box;
+            int left_count = 0;
+            for(int i=0; i<bin_count-1; ++i)
+            {
+                if(bins[i].count) left_box = left_count ? combine(left_box, bins[i].box) : bins[i].box;
+                left_count += bins[i].count;
+                if(left_count == 0 || left_count == end - begin) continue;
+                const float cost = perimeter(box) + perimeter(left_box) * left_count + right_cost[i+1]; 
+                if(cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i+1;
+                }
+            }
+        }
+
+        // If no split is cheaper than a leaf, split at the median anyway when the leaf would be too large, which can only happen when many items share a centroid
+        if(best_axis >= 0)
+        {
+            const float lo = centroid_box.min[best_axis], extent = centroid_box.max[best_axis] - lo;
+            const auto mid = std::partition(items.begin() + begin, items.begin() + end, [=](const item & it) 
+            { 
+                return std::min(static_cast<int>((centroid(it.box)[best_axis] - lo) / extent * bin_count), bin_count-1) < best_split; 
+            });
+            split(node_index, begin, static_cast<int>(mid - items.begin()), end, depth);
+        }
+        else if(end - begin > 4*max_leaf_size) split(node_index, begin, (begin + end) / 2, end, depth);
+    }
+
+    void static_bvh::split(int node_index, int begin, int mid, int end, int depth)
+    {
+        // Lay out the first child immediately after this node, followed by the entire subtree of the first child, then the second child
+        nodes[node_index].count = 0;
+        nodes.push_back({});
+        build(node_index+1, begin, mid, depth+1);
+        const int second = static_cast<int>(nodes.size());
+        nodes.push_back({});
+        nodes[node_index].index = second;
+        build(second, mid, end, depth+1);
+    }
+}
@@ -0,0 +1,98 @@
+// This is free and unencumbered software released into the public domain.
+// For more information, please refer to <http://unlicense.org/>
+#pragma once
+#include "broadphase.h"
+
+namespace broadphase
+{
+    // Bounding volume hierarchy over a fixed set of items, built once using the surface area heuristic. Nodes are stored in depth-first
+    // order, with each internal node immediately followed by its first child, and items are stored contiguously in leaf order, along with
+    // their bounds, so that queries only report items whose own bounds pass.
+    class static_bvh
+    {
+        struct node 
+        { 
+            aabb box;
+            int index;  // For internal nodes, the index of the second child. For leaf nodes, the index of the first item.
+            int count;  // Zero for internal nodes, number of items for leaf nodes
+        };
+        struct item { aabb box; int id; };
+        std::vector<node> nodes;
+        std::vector<item> items;
+        int max_leaf_size;
+
+        static constexpr int max_sah_depth = 32; // Below this depth, items are split at the median, bounding the tree depth for queries
+
+        void build(int node_index, int begin, int end, int depth);
+        void split(int node_index, int begin, int mid, int end, int depth);
+    public:
+        static_bvh() = default;
+        explicit static_bvh(const std::vector<aabb> & boxes, int max_leaf_size = 4);
+
+        size_t get_node_count() const { return nodes.size(); }
+
+        // Invokes callback(id) for every item whose bounds overlap the region, where id is the index of the item's box in the array the
+        // tree was built from. Stops early if the callback returns false.
+        template<class Callback> void query(const aabb & region, Callback callback) const
+        {
+            int stack[64], count = 0;
+            if(!nodes.empty()) stack[count++] = 0;
+            while(count)
+            {
+                const int index = stack[--count];
+                const node & n = nodes[index];
+                if(!overlaps(n.box, region)) continue;
+                if(n.count) 
+                { 
+                    for(int i=n.index; i<n.index+n.count; ++i) if(overlaps(items[i].box, region) && !callback(items[i].id)) return;
+                }
+                else
+                {
+                    stack[count++] = n.index;
+                    stack[count++] = index+1;
+                }
+            }
+        }
+
+        // Invokes callback(id, max_t) for every item whose bounds are hit by the ray origin + direction*t for t in [0, max_t], nearest 
+        // leaf first. The callback returns the new value of max_t, allowing it to clip the ray to the nearest hit so far, which prunes every 
+        // item and node beyond it, or to stop the query by returning 0.
+        template<class Callback> void raycast(const float2 & origin, const float2 & direction, float max_t, Callback callback) const
+        {
+            boxcast({origin, origin}, direction, max_t, callback);
+        }
+
+        // As raycast, but for the box swept along direction*t, reporting every item whose bounds the swept box touches
+        template<class Callback> void boxcast(const aabb & box, const float2 & direction, float max_t, Callback callback) const
+        {
+            // Boxes are grown by the size of the swept box so that the sweep reduces to a ray from its minimum corner
+            const float2 inv_direction = 1.0f / direction, size = box.max - box.min;
+            const auto get_entry = [&](const aabb & b) { return find_ray_entry({b.min - size, b.max}, box.min, inv_direction, max_t); };
+            struct entry { int node; float t; } stack[64];
+            int count = 0;
+            if(!nodes.empty()) stack[count++] = {0, get_entry(nodes[0].box)};
+            while(count)
+            {
+                const entry e = stack[--count];
+                if(e.t > max_t) continue; // Beyond a hit found since this node was pushed
+                const node & n = nodes[e.node];
+                if(n.count)
+                {
+                    // Leaves hold only a few items, which are visited in storage order rather than sorted
+                    for(int i=n.index; i<n.index+n.count; ++i) 
+                    {
+                        if(get_entry(items[i].box) > max_t) continue;
+                        max_t = callback(items[i].id, max_t);
+                        if(!(max_t > 0)) return;
+                    }
+                    continue;
+                }
+
+                // Push the farther child first, so that the nearer is visited first
+                entry children[2] {{e.node+1, get_entry(nodes[e.node+1].box)}, {n.index, get_entry(nodes[n.index].box)}};
+                if(children[0].t < children[1].t) std::swap(children[0], children[1]);
+                for(auto & c : children) if(c.t <= max_t) stack[count++] = c;
+            }
+        }
+    };
+}